@@ -0,0 +1,2036 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <malloc.h>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <lb_arena.h>
+#include <lb_command.h>
+#include <lb_defines.h>
+#include <lb_error.h>
+#include <lb_functions.h>
+#include <lb_index.h>
+#include <lb_ingest.h>
+#include <lb_leaderboard.h>
+#include <lb_metrics.h>
+#include <lb_producer.h>
+#include <lb_reminder.h>
+#include <lb_ring.h>
+#include <lb_shm.h>
+#include <lb_storage.h>
+
+using namespace std;
+
+/*
+ * Подсчет обращений к аллокатору - глобальные new/delete заменены на счетчик поверх malloc
+ */
+atomic<uint64_t> g_allocations(0);
+
+void *operator new(size_t size) {
+	g_allocations.fetch_add(1, memory_order_relaxed);
+	if (void *ptr = malloc(size ? size : 1))
+		return ptr;
+	throw bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+	free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+	free(ptr);
+}
+
+/*
+ * Эталонная реализация таблицы рейтинга на list -
+ * так, как AddWin работал до перехода на rating::Tree.
+ * Нужна только для сравнения
+ */
+class ListBoard {
+public:
+	void AddUser(const int64_t id) {
+		int64_t place = 1;
+		if (!m_board.empty())
+			place = m_board.front().place + 1;
+		BoardDesc desc;
+		desc.amount = 0;
+		desc.place = place;
+		desc.id = id;
+		m_board.push_front(desc);
+		m_users[id] = m_board.begin();
+	}
+
+	void AddWin(const int64_t id, double amount) {
+		auto cur_board = m_users[id];
+		double new_amount = cur_board->amount + amount;
+
+		auto next_board = cur_board;
+		++next_board;
+
+		if (next_board == m_board.end() || next_board->amount > new_amount) {
+			cur_board->amount = new_amount;
+			return;
+		}
+
+		int64_t place = 1;
+		for ( ; ; ++next_board) {
+			if (next_board == m_board.end()) {
+				break;
+			} else if (next_board->amount >= new_amount) {
+				place = next_board->place + 1;
+				break;
+			}
+			++(next_board->place);
+		}
+
+		cur_board->amount = new_amount;
+		cur_board->place = place;
+
+		m_users[id] = m_board.insert(next_board, *cur_board);
+		m_board.erase(cur_board);
+	}
+private:
+	struct BoardDesc {
+		double amount;
+		int64_t place;
+		int64_t id;
+	};
+
+	list<BoardDesc> m_board;
+	map<int64_t, list<BoardDesc>::iterator> m_users;
+};
+
+/*
+ * Эталонная реализация Producer на queue - публикация по одному сообщению
+ * под той же блокировкой, в которую пишет AddMessage. Нужна только для сравнения
+ */
+class QueueProducer {
+public:
+	QueueProducer(const function<void(const string &)> &publisher)
+	: m_stopped(false)
+	, m_publisher(publisher) {}
+
+	void AddMessage(const string &msg) {
+		{
+			lock_guard<mutex> cs(m_data_mutex);
+			m_messages.push(msg);
+		}
+		m_can_process.notify_one();
+	}
+
+	bool HasMessages() {
+		lock_guard<mutex> cs(m_data_mutex);
+		return !m_messages.empty();
+	}
+
+	void SendMessages() {
+		while(true) {
+			unique_lock<mutex> wait_lock(m_wait_mutex);
+			while(!m_stopped && !HasMessages()) {
+				m_can_process.wait(wait_lock);
+			}
+
+			if (m_stopped)
+				return;
+
+			lock_guard<mutex> cs(m_data_mutex);
+			if (m_messages.empty())
+				continue;
+
+			m_publisher(m_messages.front());
+			m_messages.pop();
+		}
+	}
+
+	void Stop() {
+		unique_lock<mutex> wait_lock(m_wait_mutex);
+		m_stopped = true;
+		m_can_process.notify_one();
+	}
+private:
+	atomic_bool m_stopped;
+	mutex m_data_mutex;
+	mutex m_wait_mutex;
+	condition_variable m_can_process;
+	function<void(const string &)> m_publisher;
+
+	queue<string> m_messages;
+};
+
+/*
+ * Эталонная реализация Reminder на list и отдельном потоке Sleeper - так, как рассылка работала
+ * до колеса таймеров: за проход цикла - один наступивший пользователь, блокировка списка
+ * и передача ожидания потоку Sleeper (timed_mutex::try_lock_until) и обратно. Нужна только для сравнения
+ */
+class ListReminder {
+public:
+	ListReminder(LeaderBoard &board, const function<void(const string &)> &sender)
+	: m_board(board)
+	, m_sender(sender) {}
+
+	void ConnectUser(const int64_t id) {
+		lock_guard<mutex> cs(m_data_mutex);
+
+		auto inserted = m_users.insert(make_pair(id, m_reminder.end()));
+		ReminderDesc desc;
+		desc.user = inserted.first;
+		m_reminder.push_back(desc);
+		inserted.first->second = prev(m_reminder.end());
+	}
+
+	/*
+	 * Проходы цикла Process прежней реализации. Возвращает число отправленных сообщений
+	 */
+	int64_t Process(int64_t loops) {
+		int64_t sent = 0;
+		for (int64_t loop = 0; loop < loops; ++loop) {
+			date::SteadyTimePoint timepoint;
+			string message;
+			{
+				lock_guard<mutex> cs(m_data_mutex);
+				auto cur_time = chrono::steady_clock::now();
+				if (m_reminder.empty()) {
+					timepoint = cur_time + chrono::minutes(1);
+				} else {
+					const auto &check = m_reminder.back();
+					if (check.when <= cur_time) {
+						try {
+							m_board.GetStatMessage(check.user->first, message);
+						} catch(const err::Error &e) {
+							Debug("Failed to get message. Error: " + string(e.what()));
+						}
+
+						m_reminder.push_front(check);
+
+						auto &new_check = m_reminder.front();
+						new_check.when = cur_time + chrono::minutes(1);
+						new_check.user->second = m_reminder.begin();
+
+						m_reminder.pop_back();
+
+						timepoint = m_reminder.back().when;
+					} else {
+						timepoint = check.when;
+					}
+				}
+			}
+
+			if (!message.empty()) {
+				m_sender(message);
+				++sent;
+			}
+
+			m_sleeper.SleepUntil(timepoint);
+		}
+		return sent;
+	}
+private:
+	struct ReminderDesc;
+	typedef list<ReminderDesc> ReminderList;
+	typedef map<int64_t, ReminderList::iterator> UserMap;
+
+	struct ReminderDesc {
+		date::SteadyTimePoint when;
+		UserMap::iterator user;
+		ReminderDesc() : when(chrono::steady_clock::now()) {}
+	};
+
+	class Sleeper {
+	public:
+		Sleeper()
+		: m_timeout_locked(false)
+		, m_stopped(false)
+		, m_has_timeout(false) {
+			m_sleeper_thread = thread(&Sleeper::SleeperThread, this);
+		}
+
+		~Sleeper() {
+			m_stopped = true;
+			UnlockTimeout();
+			{
+				lock_guard<mutex> cs(m_sleeper_mutex);
+			}
+			m_sleeper.notify_one();
+			m_waiter.notify_one();
+			m_sleeper_thread.join();
+		}
+
+		void SleepUntil(const date::SteadyTimePoint &timepoint) {
+			{
+				unique_lock<mutex> wait_lock(m_sleeper_mutex);
+				m_sleeper_timepoint = timepoint;
+				LockTimeout();
+			}
+
+			m_sleeper.notify_one();
+
+			unique_lock<mutex> wait_lock(m_sleeper_mutex);
+			while(!m_stopped && m_has_timeout) {
+				m_waiter.wait(wait_lock);
+			}
+
+			UnlockTimeout();
+		}
+	private:
+		bool m_timeout_locked;
+		atomic_bool m_stopped;
+		atomic_bool m_has_timeout;
+
+		thread m_sleeper_thread;
+
+		timed_mutex m_timeout_mutex;
+		mutex m_sleeper_mutex;
+
+		condition_variable m_waiter;
+		condition_variable m_sleeper;
+
+		date::SteadyTimePoint m_sleeper_timepoint;
+
+		void LockTimeout() {
+			if (m_timeout_locked)
+				return;
+
+			m_timeout_mutex.lock();
+			m_timeout_locked = true;
+			m_has_timeout = true;
+		}
+
+		void UnlockTimeout() {
+			if (!m_timeout_locked)
+				return;
+
+			m_has_timeout = false;
+			m_timeout_locked = false;
+			m_timeout_mutex.unlock();
+		}
+
+		void SleeperThread() {
+			while(true) {
+				date::SteadyTimePoint timepoint;
+				{
+					unique_lock<mutex> wait_lock(m_sleeper_mutex);
+					while(!m_stopped && !m_has_timeout) {
+						m_sleeper.wait(wait_lock);
+					}
+					timepoint = m_sleeper_timepoint;
+				}
+
+				if (m_stopped)
+					return;
+
+				if (m_timeout_mutex.try_lock_until(timepoint))
+					m_timeout_mutex.unlock();
+
+				{
+					lock_guard<mutex> cs(m_sleeper_mutex);
+					m_has_timeout = false;
+				}
+				m_waiter.notify_one();
+			}
+		}
+	};
+
+	LeaderBoard &m_board;
+	function<void(const string &)> m_sender;
+
+	UserMap m_users;
+	ReminderList m_reminder;
+	mutex m_data_mutex;
+	Sleeper m_sleeper;
+};
+
+void Measure(const string &name, int64_t ops, const function<void()> &func) {
+	auto begin = chrono::steady_clock::now();
+	func();
+	auto end = chrono::steady_clock::now();
+
+	double secs = chrono::duration<double>(end - begin).count();
+	cout << "\t" << name << ": " << ops << " ops, "
+			<< str::Str(secs * 1000, 2) << " ms, "
+			<< str::Str(secs > 0 ? ops / secs : 0, 0) << " ops/sec" << endl;
+}
+
+/*
+ * Регистрация, равномерные выигрыши, "кит" с последнего места и построение статистики
+ */
+template <class Board>
+void RunRank(Board &board, const string &name, int64_t users, int64_t ops,
+		const function<void(Board &, int64_t)> &stat) {
+	cout << name << ":" << endl;
+
+	Measure("register", users, [&]() {
+		for (int64_t id = 1; id <= users; ++id)
+			board.AddUser(id);
+	});
+
+	//каждый раз выигрывает последний в таблице и поднимается на первое место
+	Measure("whale", ops, [&]() {
+		for (int64_t cnt = 1; cnt <= ops; ++cnt)
+			board.AddWin(users - cnt + 1, cnt);
+	});
+
+	mt19937_64 random(42);
+	uniform_int_distribution<int64_t> user_dist(1, users);
+	uniform_int_distribution<int64_t> amount_dist(1, 1000);
+	Measure("uniform", ops, [&]() {
+		for (int64_t cnt = 0; cnt < ops; ++cnt)
+			board.AddWin(user_dist(random), amount_dist(random));
+	});
+
+	if (stat) {
+		Measure("stat", ops, [&]() {
+			for (int64_t cnt = 0; cnt < ops; ++cnt)
+				stat(board, user_dist(random));
+		});
+	}
+}
+
+/*
+ * Сравнение list и rating::Tree
+ */
+void BenchRank(int64_t users, int64_t ops) {
+	cout << "rank: " << users << " users, " << ops << " ops" << endl;
+
+	ListBoard list_board;
+	RunRank<ListBoard>(list_board, "list", users, ops, nullptr);
+
+	struct TreeBoard {
+		LeaderBoard board;
+		date::SystemTimePoint now = chrono::system_clock::now();
+		void AddUser(const int64_t id) { board.AddUser(id, "user" + str::Str(id)); }
+		void AddWin(const int64_t id, double amount) { board.AddWin(id, now, amount); }
+	} tree_board;
+	RunRank<TreeBoard>(tree_board, "tree", users, ops, [](TreeBoard &board, int64_t id) {
+		board.board.GetStatMessage(id);
+	});
+}
+
+/*
+ * Построение статистики для случайных пользователей заполненной таблицы
+ */
+void BenchStat(int64_t users, int64_t ops) {
+	cout << "stat: " << users << " users, " << ops << " ops" << endl;
+
+	LeaderBoard board;
+	mt19937_64 random(42);
+	uniform_int_distribution<int64_t> user_dist(1, users);
+	uniform_int_distribution<int64_t> amount_dist(1, 1000);
+	auto now = chrono::system_clock::now();
+
+	for (int64_t id = 1; id <= users; ++id)
+		board.AddUser(id, "user" + str::Str(id));
+	for (int64_t cnt = 0; cnt < users; ++cnt)
+		board.AddWin(user_dist(random), now, amount_dist(random));
+
+	size_t bytes = 0;
+	uint64_t allocations = g_allocations.load();
+	Measure("render", ops, [&]() {
+		for (int64_t cnt = 0; cnt < ops; ++cnt)
+			bytes += board.GetStatMessage(user_dist(random)).size();
+	});
+	cout << "\t" << bytes / ops << " bytes per message, "
+			<< str::Str((double)(g_allocations.load() - allocations) / ops, 1) << " allocations per message" << endl;
+}
+
+/*
+ * Пропускная способность AddWin, пока в нескольких потоках строится статистика
+ * с заданной частотой. В режиме serialized все вызовы проходят через один mutex -
+ * так работала таблица на recursive_mutex
+ */
+void RunContention(int64_t users, int64_t renders_per_sec, bool serialized) {
+	const int readers = 4;
+	const auto duration = chrono::seconds(3);
+
+	LeaderBoard board;
+	for (int64_t id = 1; id <= users; ++id)
+		board.AddUser(id, "user" + str::Str(id));
+
+	mutex serial_mutex;
+	atomic_bool stopped(false);
+	atomic<int64_t> renders(0);
+
+	vector<thread> threads;
+	for (int reader = 0; reader < readers && renders_per_sec > 0; ++reader) {
+		threads.emplace_back([&, reader]() {
+			mt19937_64 random(reader);
+			uniform_int_distribution<int64_t> user_dist(1, users);
+			auto interval = chrono::nanoseconds(1000000000LL * readers / renders_per_sec);
+			auto next = chrono::steady_clock::now();
+			while (!stopped) {
+				if (serialized) {
+					lock_guard<mutex> cs(serial_mutex);
+					board.GetStatMessage(user_dist(random));
+				} else {
+					board.GetStatMessage(user_dist(random));
+				}
+				++renders;
+
+				next += interval;
+				this_thread::sleep_until(next);
+			}
+		});
+	}
+
+	mt19937_64 random(42);
+	uniform_int_distribution<int64_t> user_dist(1, users);
+	uniform_int_distribution<int64_t> amount_dist(1, 1000);
+	auto now = chrono::system_clock::now();
+	int64_t wins = 0;
+
+	auto begin = chrono::steady_clock::now();
+	auto end = begin + duration;
+	while (chrono::steady_clock::now() < end) {
+		for (int cnt = 0; cnt < 100; ++cnt, ++wins) {
+			if (serialized) {
+				lock_guard<mutex> cs(serial_mutex);
+				board.AddWin(user_dist(random), now, amount_dist(random));
+			} else {
+				board.AddWin(user_dist(random), now, amount_dist(random));
+			}
+		}
+	}
+	double secs = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+	stopped = true;
+	for (auto &reader : threads)
+		reader.join();
+
+	string mode = renders_per_sec == 0 ? "no readers" : serialized ? "serialized" : "shared";
+	cout << "\t" << mode << ": "
+			<< str::Str(wins / secs, 0) << " wins/sec, "
+			<< str::Str(renders / secs, 0) << " renders/sec" << endl;
+}
+
+void BenchContention(int64_t users, int64_t renders_per_sec) {
+	cout << "contention: " << users << " users, " << renders_per_sec << " renders/sec target, "
+			<< thread::hardware_concurrency() << " cpus" << endl;
+
+	RunContention(users, 0, false);
+	RunContention(users, renders_per_sec, true);
+	RunContention(users, renders_per_sec, false);
+}
+
+/*
+ * Прежняя рассылка на ListReminder: каждый пользователь раз в минуту - отдельный проход цикла.
+ * Целую минуту реального времени не ждем: все пользователи уже наступили, замеряются первые loops
+ * проходов (передача ожидания Sleeper и обратно идет и с прошедшим временем), минута - пересчетом на users
+ */
+double RunListReminder(LeaderBoard &board, int64_t users) {
+	//последний замеряемый проход тоже должен застать наступившего пользователя - иначе Sleeper ждет минуту
+	const int64_t loops = min<int64_t>(users / 2, 100000);
+	if (loops == 0)
+		return 0;
+
+	int64_t sent = 0;
+	ListReminder reminder(board, [&sent](const string &) {
+		++sent;
+	});
+	for (int64_t id = 1; id <= users; ++id)
+		reminder.ConnectUser(id);
+
+	clock_t cpu_begin = clock();
+	reminder.Process(loops);
+	double cpu = double(clock() - cpu_begin) / CLOCKS_PER_SEC * users / loops;
+
+	cout << "\tlist + Sleeper: " << users << " messages, " << users << " wakeups per minute, "
+			<< str::Str(cpu * 1000, 0) << " ms cpu per minute, "
+			<< str::Str(cpu * 1000000 / users, 2) << " us per message (" << sent << " measured)" << endl;
+	return cpu;
+}
+
+/*
+ * Колесо таймеров Reminder на виртуальном времени: в первую минуту пользователи
+ * равномерно подключаются, вторая минута - установившаяся рассылка. Затем то же число
+ * пользователей на прежней рассылке (list + Sleeper)
+ */
+void BenchReminder(int64_t users) {
+	cout << "reminder: " << users << " connected users" << endl;
+
+	LeaderBoard board;
+	for (int64_t id = 1; id <= users; ++id)
+		board.AddUser(id, "user" + str::Str(id));
+
+	atomic<int64_t> sent(0);
+	Reminder reminder(board, [&sent](Reminder::Batch &batch, bool) {
+		sent += batch.size();
+	});
+	auto start = chrono::steady_clock::now();
+
+	int64_t connected = 0;
+	date::SteadyTimePoint wake;
+	for (int64_t tick = 0; tick < REMINDER_SLOTS; ++tick) {
+		for (int64_t target = users * (tick + 1) / REMINDER_SLOTS; connected < target; )
+			reminder.ConnectUser(++connected);
+		reminder.Tick(start + chrono::milliseconds(tick * REMINDER_TICK_MS), wake);
+	}
+
+	sent = 0;
+	int64_t wakeups = 0;
+	clock_t cpu_begin = clock();
+	auto now = start + chrono::milliseconds(REMINDER_PERIOD_MS);
+	auto end = now + chrono::milliseconds(REMINDER_PERIOD_MS);
+	while (now < end) {
+		reminder.Tick(now, wake);
+		++wakeups;
+		now = max(wake, now + chrono::milliseconds(REMINDER_TICK_MS));
+	}
+	double cpu = double(clock() - cpu_begin) / CLOCKS_PER_SEC;
+
+	cout << "\twheel: " << sent << " messages, " << wakeups << " wakeups per minute, "
+			<< str::Str(cpu * 1000, 0) << " ms cpu per minute, "
+			<< str::Str(sent > 0 ? cpu * 1000000 / sent : 0, 2) << " us per message" << endl;
+
+	double list_cpu = RunListReminder(board, users);
+	if (list_cpu > 0)
+		cout << "\twheel saves " << users - wakeups << " wakeups and "
+				<< str::Str((list_cpu - cpu) * 1000, 0) << " ms cpu per minute" << endl;
+}
+
+/*
+ * Вторая минута рассылки после первой: между тактами идет ops выигрышей в минуту.
+ * Сравниваются режимы для неизменившейся статистики и форматы - полный и разностный.
+ */
+void RunUnchanged(const string &name, LeaderBoard &board, Unchanged unchanged, StatFormat format,
+		int64_t users, int64_t ops) {
+	atomic<int64_t> sent(0);
+	atomic<size_t> bytes(0);
+	Reminder reminder(board, [&sent, &bytes](Reminder::Batch &batch, bool) {
+		sent += batch.size();
+		for (auto &msg : batch)
+			bytes += msg.body.size();
+	}, unchanged, format);
+
+	auto start = chrono::steady_clock::now();
+	date::SteadyTimePoint wake;
+	for (int64_t id = 1; id <= users; ++id)
+		reminder.ConnectUser(id);
+	reminder.Tick(start, wake);
+
+	mt19937_64 random(7);
+	uniform_int_distribution<int64_t> user_dist(1, users);
+	uniform_int_distribution<int64_t> amount_dist(1, 100);
+	auto win_date = chrono::system_clock::now();
+
+	sent = 0;
+	bytes = 0;
+	auto seeded = reminder.GetCounters();
+	int64_t wins = 0;
+	clock_t cpu_begin = clock();
+	for (int64_t tick = 1; tick <= REMINDER_SLOTS; ++tick) {
+		for (int64_t target = ops * tick / REMINDER_SLOTS; wins < target; ++wins)
+			board.AddWin(user_dist(random), win_date, amount_dist(random));
+		reminder.Tick(start + chrono::milliseconds(tick * REMINDER_TICK_MS), wake);
+	}
+	double cpu = double(clock() - cpu_begin) / CLOCKS_PER_SEC;
+
+	auto counters = reminder.GetCounters();
+	cout << "\t" << name << ": " << sent << " messages, " << bytes / users << " bytes per user-minute, "
+			<< counters.sent - seeded.sent << " changed, " << counters.unchanged - seeded.unchanged << " unchanged, "
+			<< str::Str(cpu * 1000, 0) << " ms cpu per minute" << endl;
+}
+
+void BenchUnchanged(int64_t users, int64_t ops) {
+	cout << "unchanged: " << users << " connected users, " << ops << " wins per minute" << endl;
+
+	//у каждого прогона своя одинаковая таблица - иначе выигрыши прошлых прогонов сменят лидеров
+	auto run = [users, ops](const string &name, Unchanged unchanged, StatFormat format) {
+		LeaderBoard board;
+		mt19937_64 random(42);
+		uniform_int_distribution<int64_t> amount_dist(1, 1000000);
+		auto now = chrono::system_clock::now();
+		for (int64_t id = 1; id <= users; ++id) {
+			board.AddUser(id, "user" + str::Str(id));
+			board.AddWin(id, now, amount_dist(random));
+		}
+		RunUnchanged(name, board, unchanged, format, users, ops);
+	};
+
+	run("full, send", Unchanged::SEND, StatFormat::FULL);
+	run("full, skip", Unchanged::SKIP, StatFormat::FULL);
+	run("full, heartbeat", Unchanged::HEARTBEAT, StatFormat::FULL);
+	run("delta, send", Unchanged::SEND, StatFormat::DELTA);
+	run("delta, skip", Unchanged::SKIP, StatFormat::DELTA);
+	run("delta, heartbeat", Unchanged::HEARTBEAT, StatFormat::DELTA);
+}
+
+/*
+ * Начало нагруженной минуты: все пользователи наступают в один такт.
+ * Задержка - от начала такта до постановки сообщения в очередь, по числу потоков построения
+ */
+void BenchLag(int64_t users) {
+	cout << "lag: " << users << " users due in one tick" << endl;
+
+	LeaderBoard board;
+	mt19937_64 random(42);
+	uniform_int_distribution<int64_t> amount_dist(1, 1000000);
+	auto now = chrono::system_clock::now();
+	for (int64_t id = 1; id <= users; ++id) {
+		board.AddUser(id, "user" + str::Str(id));
+		board.AddWin(id, now, amount_dist(random));
+	}
+
+	for (int workers : {1, 2, 4}) {
+		mutex lags_mutex;
+		vector<double> lags;
+		lags.reserve(users);
+		date::SteadyTimePoint tick_start;
+		Reminder reminder(board, [&](Reminder::Batch &batch, bool) {
+			double lag = chrono::duration<double, milli>(chrono::steady_clock::now() - tick_start).count();
+			lock_guard<mutex> cs(lags_mutex);
+			lags.insert(lags.end(), batch.size(), lag);
+		}, Unchanged::SEND, StatFormat::FULL, workers);
+
+		for (int64_t id = 1; id <= users; ++id)
+			reminder.ConnectUser(id);
+
+		date::SteadyTimePoint wake;
+		tick_start = chrono::steady_clock::now();
+		reminder.Tick(tick_start, wake);
+
+		sort(lags.begin(), lags.end());
+		auto percentile = [&lags](double share) {
+			return lags.empty() ? 0 : lags[min(lags.size() - 1, static_cast<size_t>(lags.size() * share))];
+		};
+		cout << "\t" << workers << " threads: " << lags.size() << " messages, lag p50 " << str::Str(percentile(0.5), 1)
+				<< " ms, p99 " << str::Str(percentile(0.99), 1) << " ms, max " << str::Str(percentile(1), 1) << " ms" << endl;
+	}
+}
+
+/*
+ * Имитация BasicPublish: занимает поток на заданное время
+ */
+void Publish(chrono::nanoseconds cost) {
+	auto end = chrono::steady_clock::now() + cost;
+	while (chrono::steady_clock::now() < end) {}
+}
+
+template <class ProducerType>
+void RunProducer(ProducerType &producer, const string &name, int64_t messages, atomic<int64_t> &published) {
+	const string message(1000, 'x');
+
+	thread sender(&ProducerType::SendMessages, &producer);
+
+	auto begin = chrono::steady_clock::now();
+	chrono::nanoseconds add_max(0);
+	for (int64_t cnt = 0; cnt < messages; ++cnt) {
+		auto add_begin = chrono::steady_clock::now();
+		producer.AddMessage(message);
+		add_max = max(add_max, chrono::steady_clock::now() - add_begin);
+	}
+	auto added = chrono::steady_clock::now();
+
+	while (published < messages)
+		this_thread::yield();
+	auto end = chrono::steady_clock::now();
+
+	producer.Stop();
+	sender.join();
+
+	double add_secs = chrono::duration<double>(added - begin).count();
+	double secs = chrono::duration<double>(end - begin).count();
+	cout << "\t" << name << ": " << str::Str(messages / secs, 0) << " messages/sec published, "
+			<< str::Str(add_secs * 1000000000 / messages, 0) << " ns avg AddMessage, "
+			<< str::Str(chrono::duration<double, micro>(add_max).count(), 0) << " us max AddMessage" << endl;
+}
+
+/*
+ * Сравнение Producer с прежней очередью при публикации стоимостью 2 мкс на сообщение
+ */
+void BenchProducer(int64_t messages) {
+	const auto cost = chrono::microseconds(2);
+	cout << "producer: " << messages << " messages, 2 us per publish" << endl;
+
+	atomic<int64_t> published(0);
+	QueueProducer queue_producer([&](const string &) {
+		Publish(cost);
+		++published;
+	});
+	RunProducer(queue_producer, "queue", messages, published);
+
+	published = 0;
+	Producer producer([&](const Producer::Batch &batch) {
+		for (size_t cnt = 0; cnt < batch.size(); ++cnt)
+			Publish(cost);
+		published += batch.size();
+	});
+	RunProducer(producer, "batch", messages, published);
+}
+
+/*
+ * Задержка от постановки сообщения о подключении до публикации, пока разбирается хвост рассылки:
+ * в очереди backlog сообщений по 2 мкс, раз в миллисекунду приходит подключение
+ */
+void RunConnect(const string &name, int64_t backlog, int64_t connects, int high_weight, int bulk_weight, bool lanes) {
+	const auto cost = chrono::microseconds(2);
+	vector<date::SteadyTimePoint> added(connects);
+	vector<double> lags;
+	lags.reserve(connects);
+	atomic<int64_t> published(0);
+
+	Producer producer([&](const Producer::Batch &batch) {
+		for (auto &msg : batch) {
+			Publish(cost);
+			if (msg[0] == 'c')
+				lags.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - added[str::Int64(msg.substr(1))]).count());
+		}
+		published += batch.size();
+	}, high_weight, bulk_weight);
+
+	const string bulk(1000, 'x');
+	for (int64_t cnt = 0; cnt < backlog; ++cnt)
+		producer.AddMessage(bulk);
+
+	thread sender(&Producer::SendMessages, &producer);
+	for (int64_t cnt = 0; cnt < connects; ++cnt) {
+		this_thread::sleep_for(chrono::milliseconds(1));
+		added[cnt] = chrono::steady_clock::now();
+		producer.AddMessage("c" + str::Str(cnt), lanes ? Producer::HIGH : Producer::BULK);
+	}
+
+	while (published < backlog + connects)
+		this_thread::yield();
+	producer.Stop();
+	sender.join();
+
+	sort(lags.begin(), lags.end());
+	cout << "\t" << name << ": connect lag p50 " << str::Str(lags[lags.size() / 2], 2) << " ms, p99 "
+			<< str::Str(lags[lags.size() * 99 / 100], 2) << " ms, max " << str::Str(lags.back(), 2) << " ms" << endl;
+}
+
+void BenchConnect(int64_t backlog, int64_t connects) {
+	cout << "connect: " << backlog << " messages backlog, " << connects << " connects, 2 us per publish" << endl;
+
+	RunConnect("one lane", backlog, connects, 1, 1, false);
+	RunConnect("lanes 1:1", backlog, connects, 1, 1, true);
+	RunConnect("lanes 4:1", backlog, connects, 4, 1, true);
+}
+
+/*
+ * Разбор сообщения так, как это делал IncomingListener::ProcessMessage до cmd::Parse:
+ * копия тела и копия каждого поля через str::GetWord
+ */
+void ParseLegacy(const string &body, cmd::Command &command) {
+	string msg = body;
+	string msg_type = str::GetWord(msg, '\n');
+	string id_str = str::GetWord(msg, '\n');
+
+	if (!test::Numeric(id_str))
+		throw err::Error("invalid", "id", id_str);
+	command.id = str::Int64(id_str);
+
+	if (msg_type == MSG_USER_REGISTER || msg_type == MSG_USER_RENAME) {
+		string name = str::GetWord(msg, '\n');
+		if (!test::Username(name))
+			throw err::Error("invalid", "username", name);
+		command.type = msg_type == MSG_USER_REGISTER ? cmd::USER_REGISTER : cmd::USER_RENAME;
+	} else if (msg_type == MSG_USER_WON) {
+		string date_str = str::GetWord(msg, '\n');
+		string amount_str = str::GetWord(msg, '\n');
+		command.amount = str::Double(amount_str);
+		if (command.amount <= 0)
+			throw err::Error("invalid", "amount", amount_str);
+		command.date = date::FromString(date_str);
+		command.type = cmd::USER_WON;
+	} else if (msg_type == MSG_USER_CONNECT) {
+		command.type = cmd::USER_CONNECT;
+	} else if (msg_type == MSG_USER_DISCONNECT) {
+		command.type = cmd::USER_DISCONNECT;
+	} else
+		throw err::Error("invalid", "msg_type", msg_type);
+}
+
+/*
+ * Смесь сообщений, близкая к боевой: 70% выигрышей, 10% регистраций, 5% переименований,
+ * 10% подключений и 5% отключений
+ */
+vector<string> MakeMessages(int64_t users, int64_t count) {
+	mt19937_64 random(42);
+	uniform_int_distribution<int64_t> user_dist(1, users);
+	uniform_int_distribution<int> type_dist(0, 99);
+	uniform_int_distribution<int> amount_dist(1, 100000);
+	const string now = date::Format(chrono::system_clock::now());
+
+	vector<string> messages;
+	messages.reserve(count);
+	for (int64_t cnt = 0; cnt < count; ++cnt) {
+		int type = type_dist(random);
+		string id = str::Str(user_dist(random));
+		if (type < 70)
+			messages.push_back(MSG_USER_WON + "\n" + id + "\n" + now + "\n" + str::Str(amount_dist(random) / 100.0, 2));
+		else if (type < 80)
+			messages.push_back(MSG_USER_REGISTER + "\n" + id + "\nuser" + id);
+		else if (type < 85)
+			messages.push_back(MSG_USER_RENAME + "\n" + id + "\nrenamed" + id);
+		else if (type < 95)
+			messages.push_back(MSG_USER_CONNECT + "\n" + id);
+		else
+			messages.push_back(MSG_USER_DISCONNECT + "\n" + id);
+	}
+	return messages;
+}
+
+/*
+ * Разбор входящих сообщений: прежний разбор через копии и cmd::Parse
+ */
+void BenchParse(int64_t users, int64_t ops) {
+	cout << "parse: " << ops << " messages" << endl;
+
+	auto messages = MakeMessages(users, ops);
+	cmd::Command command;
+	int64_t wins = 0;
+
+	Measure("legacy", ops, [&]() {
+		for (auto &msg : messages) {
+			ParseLegacy(msg, command);
+			wins += command.type == cmd::USER_WON;
+		}
+	});
+
+	Measure("view", ops, [&]() {
+		for (auto &msg : messages) {
+			cmd::Parse(msg, command);
+			wins += command.type == cmd::USER_WON;
+		}
+	});
+}
+
+/*
+ * Применение выигрышей по одному и пачками по INPUT_BATCH_SIZE
+ * Распределение перекошено: на пятую часть пользователей приходится большая часть выигрышей
+ */
+void BenchIngest(int64_t users, int64_t ops) {
+	cout << "ingest: " << users << " users, " << ops << " wins, batch " << INPUT_BATCH_SIZE << endl;
+
+	mt19937_64 random(42);
+	uniform_real_distribution<double> skew_dist(0, 1);
+	uniform_int_distribution<int64_t> amount_dist(1, 1000);
+	auto now = chrono::system_clock::now();
+
+	vector<LeaderBoard::Win> wins;
+	wins.reserve(ops);
+	for (int64_t cnt = 0; cnt < ops; ++cnt) {
+		int64_t id = 1 + static_cast<int64_t>((users - 1) * pow(skew_dist(random), 3));
+		wins.push_back({id, now, double(amount_dist(random))});
+	}
+
+	LeaderBoard single;
+	LeaderBoard batched;
+	for (int64_t id = 1; id <= users; ++id) {
+		single.AddUser(id, "user" + str::Str(id));
+		batched.AddUser(id, "user" + str::Str(id));
+	}
+
+	Measure("single", ops, [&]() {
+		for (auto &win : wins)
+			single.AddWin(win.id, win.date, win.amount);
+	});
+
+	vector<LeaderBoard::Win> batch;
+	Measure("batch", ops, [&]() {
+		for (size_t begin = 0; begin < wins.size(); begin += INPUT_BATCH_SIZE) {
+			batch.assign(wins.begin() + begin, wins.begin() + min(wins.size(), begin + INPUT_BATCH_SIZE));
+			batched.AddWins(batch);
+		}
+	});
+}
+
+/*
+ * Разбор и применение в одном потоке (как прием до конвейера) и через конвейер Ingest
+ * Смесь: 90% выигрышей и 10% переименований зарегистрированных пользователей
+ */
+void RunPipeline(const vector<string> &messages, int64_t users, int decoders) {
+	LeaderBoard board;
+	for (int64_t id = 1; id <= users; ++id)
+		board.AddUser(id, "user" + str::Str(id));
+	Reminder reminder(board, [](Reminder::Batch &, bool) {});
+
+	Ingest ingest(board, reminder, nullptr, decoders);
+	ingest.Start();
+	Measure("pipeline x" + str::Str((int64_t)decoders), messages.size(), [&]() {
+		for (auto &msg : messages)
+			ingest.Push({nullptr, msg});
+		while (ingest.Applied() < messages.size())
+			this_thread::yield();
+	});
+	ingest.Stop();
+}
+
+vector<string> MakeWinsAndRenames(int64_t users, int64_t ops) {
+	mt19937_64 random(42);
+	uniform_int_distribution<int64_t> user_dist(1, users);
+	uniform_int_distribution<int> type_dist(0, 9);
+	uniform_int_distribution<int> amount_dist(1, 100000);
+	const string now = date::Format(chrono::system_clock::now());
+
+	vector<string> messages;
+	messages.reserve(ops);
+	for (int64_t cnt = 0; cnt < ops; ++cnt) {
+		string id = str::Str(user_dist(random));
+		if (type_dist(random) > 0)
+			messages.push_back(MSG_USER_WON + "\n" + id + "\n" + now + "\n" + str::Str(amount_dist(random) / 100.0, 2));
+		else
+			messages.push_back(MSG_USER_RENAME + "\n" + id + "\nrenamed" + id);
+	}
+	return messages;
+}
+
+void BenchPipeline(int64_t users, int64_t ops) {
+	cout << "pipeline: " << users << " users, " << ops << " messages" << endl;
+
+	vector<string> messages = MakeWinsAndRenames(users, ops);
+	LeaderBoard board;
+	for (int64_t id = 1; id <= users; ++id)
+		board.AddUser(id, "user" + str::Str(id));
+
+	Measure("inline", ops, [&]() {
+		vector<LeaderBoard::Win> wins;
+		cmd::Command command;
+		for (auto &msg : messages) {
+			cmd::Parse(msg, command);
+			if (command.type == cmd::USER_WON) {
+				wins.push_back({command.id, command.date, command.amount});
+				continue;
+			}
+			board.AddWins(wins);
+			wins.clear();
+			board.RenameUser(command.id, command.name);
+		}
+		board.AddWins(wins);
+	});
+
+	RunPipeline(messages, users, 1);
+	RunPipeline(messages, users, INGEST_DECODERS);
+}
+
+/*
+ * Цена метрик: процессорное время конвейера приема и рассылки колеса без метрик и с ними.
+ * Скорость общей машины плавает от прогона к прогону на десятки процентов, поэтому режимы чередуются
+ * короткими отрезками одного прогона (METRICS_BLOCK сообщений конвейера, такт колеса), а время
+ * складывается по режимам. Третий режим - снова без метрик: его расхождение с первым и есть шум замера.
+ * Рассылка - на виртуальном времени, как в BenchReminder
+ */
+enum MetricsMode {
+	METRICS_OFF,
+	METRICS_ON,
+	METRICS_OFF_AGAIN,
+	METRICS_MODES
+};
+
+const int64_t METRICS_BLOCK = 1000;
+//конвейер проходит сообщения METRICS_PASSES раз, колесо крутится METRICS_MINUTES минут
+const int METRICS_PASSES = 15;
+const int METRICS_MINUTES = 6;
+
+double CpuSince(clock_t begin) {
+	return double(clock() - begin) / CLOCKS_PER_SEC;
+}
+
+//порядок режимов сдвигается каждый круг, чтобы ни один не шел всегда за одним и тем же
+MetricsMode StartBlock(int64_t block) {
+	auto mode = static_cast<MetricsMode>((block + block / METRICS_MODES) % METRICS_MODES);
+	if (mode == METRICS_ON)
+		metrics::Enable();
+	else
+		metrics::Disable();
+	return mode;
+}
+
+void RunMetricsPipeline(const vector<string> &messages, int64_t users, double (&cpu)[METRICS_MODES]) {
+	LeaderBoard board;
+	for (int64_t id = 1; id <= users; ++id)
+		board.AddUser(id, "user" + str::Str(id));
+	Reminder reminder(board, [](Reminder::Batch &, bool) {});
+
+	Ingest ingest(board, reminder, nullptr, INGEST_DECODERS);
+	ingest.Start();
+	//целое число кругов режимов по METRICS_BLOCK сообщений
+	int64_t blocks = max<int64_t>(1, messages.size() * METRICS_PASSES / (METRICS_BLOCK * METRICS_MODES)) * METRICS_MODES;
+	size_t next = 0;
+	uint64_t pushed = 0;
+	for (int64_t block = 0; block < blocks; ++block) {
+		MetricsMode mode = StartBlock(block);
+		clock_t cpu_begin = clock();
+		for (int64_t cnt = 0; cnt < METRICS_BLOCK; ++cnt) {
+			ingest.Push({nullptr, messages[next]});
+			next = (next + 1) % messages.size();
+		}
+		pushed += METRICS_BLOCK;
+		while (ingest.Applied() < pushed)
+			this_thread::sleep_for(chrono::microseconds(100));
+		cpu[mode] += CpuSince(cpu_begin);
+	}
+	ingest.Stop();
+}
+
+void RunMetricsWheel(LeaderBoard &board, int64_t users, double (&cpu)[METRICS_MODES]) {
+	Producer producer([](const Producer::Batch &) {});
+	Reminder reminder(board, [&producer](Reminder::Batch &batch, bool connected) {
+		producer.AddMessages(batch, connected ? Producer::HIGH : Producer::BULK);
+	}, Unchanged::SEND);
+	thread sender(&Producer::SendMessages, &producer);
+
+	//подключения растянуты на первую минуту, как в BenchReminder, - пользователи ложатся по всем слотам
+	auto start = chrono::steady_clock::now();
+	int64_t connected = 0;
+	date::SteadyTimePoint wake;
+	for (int64_t tick = 0; tick < REMINDER_SLOTS; ++tick) {
+		for (int64_t target = users * (tick + 1) / REMINDER_SLOTS; connected < target; )
+			reminder.ConnectUser(++connected);
+		reminder.Tick(start + chrono::milliseconds(tick * REMINDER_TICK_MS), wake);
+	}
+	while (producer.GetCounters().queued > 0)
+		this_thread::sleep_for(chrono::microseconds(100));
+
+	//такт с отправкой всего построенного - один отрезок
+	for (int64_t block = 0; block < METRICS_MINUTES * REMINDER_SLOTS; ++block) {
+		MetricsMode mode = StartBlock(block);
+		clock_t cpu_begin = clock();
+		reminder.Tick(start + chrono::milliseconds((REMINDER_SLOTS + block) * REMINDER_TICK_MS), wake);
+		while (producer.GetCounters().queued > 0)
+			this_thread::sleep_for(chrono::microseconds(100));
+		cpu[mode] += CpuSince(cpu_begin);
+	}
+
+	producer.Stop();
+	sender.join();
+}
+
+void BenchMetrics(int64_t users, int64_t ops) {
+	cout << "metrics: " << users << " users, " << ops << " messages x " << METRICS_PASSES << ", wheel "
+			<< METRICS_MINUTES << " minutes, time sampled 1/" << METRICS_SAMPLE << endl;
+
+	vector<string> messages = MakeWinsAndRenames(users, ops);
+	LeaderBoard board;
+	for (int64_t id = 1; id <= users; ++id)
+		board.AddUser(id, "user" + str::Str(id));
+
+	double pipeline[METRICS_MODES] = {};
+	double wheel[METRICS_MODES] = {};
+	RunMetricsPipeline(messages, users, pipeline);
+	RunMetricsWheel(board, users, wheel);
+	metrics::Enable();
+
+	auto print = [](const string &name, const double (&cpu)[METRICS_MODES]) {
+		double off = cpu[METRICS_OFF];
+		auto percent = [off](double cpu) {
+			return str::Str(off > 0 ? (cpu - off) / off * 100 : 0, 2);
+		};
+		cout << "\t" << name << ": " << str::Str(off * 1000, 1) << " ms cpu, with metrics "
+				<< str::Str(cpu[METRICS_ON] * 1000, 1) << " ms, overhead " << percent(cpu[METRICS_ON])
+				<< "%, noise (off against off) " << percent(cpu[METRICS_OFF_AGAIN]) << "%" << endl;
+	};
+	print("pipeline", pipeline);
+	print("wheel", wheel);
+
+	string report;
+	Measure("report", 1, [&]() {
+		report = metrics::Report();
+	});
+	cout << report;
+
+	Measure("metrics::Add", ops, [&]() {
+		for (int64_t cnt = 0; cnt < ops; ++cnt)
+			metrics::Add(metrics::RENDER, cnt);
+	});
+	Measure("sampled timing", ops, [&]() {
+		for (int64_t cnt = 0; cnt < ops; ++cnt) {
+			const bool timed = metrics::Sample();
+			const auto begin = timed ? chrono::steady_clock::now() : date::SteadyTimePoint();
+			if (timed)
+				metrics::Add(metrics::RENDER, metrics::Nanoseconds(begin));
+		}
+	});
+}
+
+/*
+ * Время восстановления после перезапуска: проигрыш всей истории недели из журнала
+ * против загрузки снимка и проигрыша хвоста журнала (ops выигрышей после снимка)
+ *
+ * После проверки восстановленного состояния делает с него снимок и пишет tail в новый журнал
+ */
+void RunRestore(const string &dir, const string &name, int64_t users, int64_t connected,
+		const vector<LeaderBoard::Win> &tail) {
+	LeaderBoard board;
+	Reminder reminder(board, [](Reminder::Batch &, bool) {});
+	Storage storage(dir);
+	Ingest ingest(board, reminder, &storage, 1);
+
+	Measure(name, users, [&]() {
+		ingest.Restore();
+	});
+
+	date::SteadyTimePoint wake;
+	if (board.GetStatMessage(users / 2).empty() || reminder.Tick(chrono::steady_clock::now(), wake) != size_t(connected))
+		throw err::Error("failed", "restore", name);
+
+	if (tail.empty())
+		return;
+
+	Measure("snapshot", users, [&]() {
+		storage.Snapshot(board, reminder);
+	});
+
+	for (size_t begin = 0; begin < tail.size(); begin += INPUT_BATCH_SIZE)
+		storage.Append(vector<LeaderBoard::Win>(tail.begin() + begin, tail.begin() + min(tail.size(), begin + INPUT_BATCH_SIZE)));
+	storage.Flush();
+}
+
+void BenchRestore(int64_t users, int64_t ops) {
+	const string dir = "/tmp/lb_bench_storage";
+	const int64_t connected = min<int64_t>(users, 10000);
+	const int64_t history = users * 2;
+	cout << "restore: " << users << " users, " << history << " wins before snapshot, " << ops << " after" << endl;
+
+	auto clean = [&dir]() {
+		remove((dir + "/snapshot").c_str());
+		for (int generation = 0; generation < 8; ++generation)
+			remove((dir + "/journal." + str::Str((int64_t)generation)).c_str());
+	};
+	clean();
+
+	mt19937_64 random(42);
+	uniform_int_distribution<int64_t> user_dist(1, users);
+	uniform_int_distribution<int> amount_dist(1, 100000);
+	auto now = chrono::system_clock::now();
+
+	auto win = [&]() {
+		return LeaderBoard::Win{user_dist(random), now, amount_dist(random) / 100.0};
+	};
+
+	{
+		LeaderBoard board;
+		Reminder reminder(board, [](Reminder::Batch &, bool) {});
+		Storage storage(dir);
+		storage.Restore(board, reminder, [](const cmd::Command &) {});
+
+		cmd::Command command;
+		command.type = cmd::USER_REGISTER;
+		for (int64_t id = 1; id <= users; ++id) {
+			string name = "user" + str::Str(id);
+			command.id = id;
+			command.name = name;
+			board.AddUser(id, command.name);
+			storage.Append(command);
+		}
+
+		command.type = cmd::USER_CONNECT;
+		for (int64_t id = 1; id <= connected; ++id) {
+			command.id = id;
+			reminder.ConnectUser(id);
+			storage.Append(command);
+		}
+
+		vector<LeaderBoard::Win> wins;
+		for (int64_t cnt = 0; cnt < history; ++cnt) {
+			wins.push_back(win());
+			if (wins.size() >= static_cast<size_t>(INPUT_BATCH_SIZE) || cnt + 1 == history) {
+				storage.Append(wins);
+				board.AddWins(wins);
+				wins.clear();
+			}
+		}
+		storage.Flush();
+	}
+
+	vector<LeaderBoard::Win> tail;
+	for (int64_t cnt = 0; cnt < ops; ++cnt)
+		tail.push_back(win());
+
+	RunRestore(dir, "journal only", users, connected, tail);
+	RunRestore(dir, "snapshot + tail", users, connected, vector<LeaderBoard::Win>());
+	clean();
+}
+
+/*
+ * Хранилище пользователей: прежний map<id, UserDesc> против flat::Index и массива имен
+ * Память - прирост занятого в куче, поиск - случайные существующие id
+ */
+struct MapUserDesc {
+	string name;
+	rating::Handle board;
+};
+
+//крупные блоки malloc отдает через mmap, они учитываются отдельно
+size_t HeapUsed() {
+	auto info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+}
+
+void RunUsers(const string &name, int64_t users, const vector<int64_t> &lookups,
+		const function<void(int64_t)> &add, const function<uint32_t(int64_t)> &find) {
+	size_t heap = HeapUsed();
+	Measure(name + " insert", users, [&]() {
+		for (int64_t id = 1; id <= users; ++id)
+			add(id);
+	});
+	cout << "		" << str::Str((double)(HeapUsed() - heap) / users, 1) << " bytes/user" << endl;
+
+	uint64_t found = 0;
+	Measure(name + " lookup", lookups.size(), [&]() {
+		for (auto id : lookups)
+			found += find(id);
+	});
+	if (found == 0)
+		cout << "		nothing found" << endl;
+}
+
+void BenchUsers(int64_t users, int64_t ops) {
+	cout << "users: " << users << " users, " << ops << " lookups" << endl;
+
+	mt19937_64 random(42);
+	uniform_int_distribution<int64_t> user_dist(1, users);
+	vector<int64_t> lookups;
+	for (int64_t cnt = 0; cnt < ops; ++cnt)
+		lookups.push_back(user_dist(random));
+
+	{
+		flat::Index index;
+		vector<string> names;
+		RunUsers("flat", users, lookups, [&](int64_t id) {
+			index.Insert(id, static_cast<uint32_t>(names.size()));
+			names.push_back("user" + str::Str(id));
+		}, [&](int64_t id) {
+			return index.Find(id);
+		});
+	}
+
+	//узел map с именем в SSO - около 96 байт на пользователя
+	size_t available = static_cast<size_t>(sysconf(_SC_AVPHYS_PAGES)) * sysconf(_SC_PAGESIZE);
+	if (static_cast<size_t>(users) * 96 > available * 9 / 10) {
+		cout << "	map: skipped, needs about " << users * 96 / (1 << 20) << " MB" << endl;
+		return;
+	}
+
+	map<int64_t, MapUserDesc> index;
+	rating::Handle handle = 0;
+	RunUsers("map", users, lookups, [&](int64_t id) {
+		index.insert(make_pair(id, MapUserDesc{"user" + str::Str(id), handle++}));
+	}, [&](int64_t id) {
+		auto fnd = index.find(id);
+		return fnd == index.end() ? flat::Index::NONE : fnd->second.board;
+	});
+}
+
+/*
+ * Имена пользователей: vector<string> против arena::Names
+ * Имена случайные, 4-16 символов, затем ops переименований и уплотнение арены
+ */
+size_t ResidentSize() {
+	size_t pages = 0, resident = 0;
+	ifstream statm("/proc/self/statm");
+	statm >> pages >> resident;
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+struct MemoryMark {
+	size_t heap = HeapUsed();
+	size_t rss = ResidentSize();
+	uint64_t allocations = g_allocations.load();
+
+	void Print(const string &name, int64_t users) const {
+		cout << "		" << name << ": heap " << str::Str((double)(HeapUsed() - heap) / users, 1) << " bytes/user, rss +"
+				<< (ResidentSize() - rss) / (1 << 20) << " MB, allocations " << g_allocations.load() - allocations << endl;
+	}
+};
+
+string RandomName(mt19937_64 &random) {
+	static const char ALPHABET[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+	uniform_int_distribution<int> length_dist(4, 16);
+	uniform_int_distribution<int> char_dist(0, sizeof(ALPHABET) - 2);
+
+	string name(length_dist(random), ' ');
+	for (auto &chr : name)
+		chr = ALPHABET[char_dist(random)];
+	return name;
+}
+
+void RunNames(const string &name, const vector<string> &names, const vector<pair<uint32_t, string>> &renames,
+		const function<void()> &reserve, const function<void(const string&)> &add, const function<void(uint32_t, const string&)> &set,
+		const function<void(uint32_t, string&)> &render) {
+	const int64_t users = names.size();
+	MemoryMark mark;
+	reserve();
+	Measure(name + " add", users, [&]() {
+		for (auto &user_name : names)
+			add(user_name);
+	});
+	mark.Print("after add", users);
+
+	Measure(name + " rename", renames.size(), [&]() {
+		for (auto &rename : renames)
+			set(rename.first, rename.second);
+	});
+	mark.Print("after rename", users);
+
+	string buffer;
+	uint64_t rendered = 0;
+	Measure(name + " render", users, [&]() {
+		for (uint32_t slot = 0; slot < users; ++slot) {
+			buffer.clear();
+			render(slot, buffer);
+			rendered += buffer.size();
+		}
+	});
+	if (rendered == 0)
+		cout << "		nothing rendered" << endl;
+}
+
+void BenchNames(int64_t users, int64_t ops) {
+	cout << "names: " << users << " users, " << ops << " renames" << endl;
+
+	mt19937_64 random(42);
+	vector<string> names;
+	names.reserve(users);
+	for (int64_t cnt = 0; cnt < users; ++cnt)
+		names.push_back(RandomName(random));
+
+	uniform_int_distribution<uint32_t> user_dist(0, users - 1);
+	vector<pair<uint32_t, string>> renames;
+	renames.reserve(ops);
+	for (int64_t cnt = 0; cnt < ops; ++cnt)
+		renames.emplace_back(user_dist(random), RandomName(random));
+
+	{
+		vector<string> strings;
+		RunNames("vector<string>", names, renames, [&]() {
+			strings.reserve(users);
+		}, [&](const string &name) {
+			strings.push_back(name);
+		}, [&](uint32_t slot, const string &name) {
+			strings[slot] = name;
+		}, [&](uint32_t slot, string &buffer) {
+			buffer += strings[slot];
+		});
+	}
+
+	arena::Names arena;
+	RunNames("arena", names, renames, [&]() {
+		arena.Reserve(users);
+	}, [&](const string &name) {
+		arena.Add(name);
+	}, [&](uint32_t slot, const string &name) {
+		arena.Set(slot, name);
+	}, [&](uint32_t slot, string &buffer) {
+		buffer += arena.Get(slot);
+	});
+
+	cout << "		arena " << arena.MemoryUsage() / (1 << 20) << " MB, garbage " << arena.Garbage() / (1 << 20) << " MB" << endl;
+	int64_t steps = 0;
+	auto start = chrono::steady_clock::now();
+	while (arena.CompactStep())
+		++steps;
+	auto duration = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	cout << "		compacted in " << steps << " steps, " << str::Str(duration, 1) << " ms: arena "
+			<< arena.MemoryUsage() / (1 << 20) << " MB, garbage " << arena.Garbage() / (1 << 20) << " MB" << endl;
+
+	//после уплотнения имена должны совпадать с результатом переименований
+	for (auto &rename : renames)
+		names[rename.first] = rename.second;
+	for (uint32_t slot = 0; slot < users; ++slot) {
+		if (arena.Get(slot) != names[slot])
+			throw err::Error("mismatch", "username", str::Str(slot));
+	}
+}
+
+/*
+ * Брокер медленнее рассылки: rounds раз подряд всем users ставится полное сообщение,
+ * публикация - 20 мкс. Отставание - на сколько раундов опубликованное старее последнего
+ */
+void RunBackpressure(const string &name, int64_t users, int64_t rounds, bool keyed, size_t limit, Overflow overflow) {
+	const auto cost = chrono::microseconds(20);
+	atomic<int64_t> round(0);
+	vector<int64_t> staleness;
+	Producer producer([&](const Producer::Batch &batch) {
+		for (auto &msg : batch) {
+			Publish(cost);
+			int64_t sent = 0;
+			str::ToInt64(string_view(msg).substr(0, msg.find('\n')), sent);
+			staleness.push_back(round - sent);
+		}
+	}, PRODUCER_HIGH_WEIGHT, PRODUCER_BULK_WEIGHT, limit, overflow);
+
+	size_t heap = HeapUsed();
+	size_t heap_max = 0;
+	thread sender(&Producer::SendMessages, &producer);
+	const string padding(1000, 'x');
+	Producer::Messages batch;
+	auto begin = chrono::steady_clock::now();
+	for (round = 0; round < rounds; ++round) {
+		for (int64_t id = 1; id <= users; ++id) {
+			batch.push_back(Producer::Message{id, keyed ? Producer::Message::FULL : Producer::Message::OTHER,
+					str::Str(round.load()) + "\n" + padding});
+			if (batch.size() == REMINDER_BATCH_SIZE) {
+				producer.AddMessages(batch);
+				batch.clear();
+			}
+		}
+		heap_max = max(heap_max, HeapUsed() - heap);
+	}
+	producer.AddMessages(batch);
+	double feed_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+
+	while (producer.GetCounters().queued > 0)
+		this_thread::sleep_for(chrono::milliseconds(1));
+	producer.Stop();
+	sender.join();
+
+	auto counters = producer.GetCounters();
+	sort(staleness.begin(), staleness.end());
+	cout << "\t" << name << ": fed in " << str::Str(feed_ms, 0) << " ms, max queued " << counters.max_queued
+			<< ", heap max " << heap_max / (1 << 20) << " MB, published " << staleness.size()
+			<< ", superseded " << counters.superseded << ", dropped " << counters.dropped << ", blocked " << counters.blocked
+			<< ", staleness p50 " << staleness[staleness.size() / 2] << " p99 " << staleness[staleness.size() * 99 / 100]
+			<< " rounds" << endl;
+}
+
+void BenchBackpressure(int64_t users, int64_t rounds) {
+	cout << "backpressure: " << users << " users, " << rounds << " rounds, 20 us per publish" << endl;
+
+	RunBackpressure("unbounded", users, rounds, false, SIZE_MAX, Overflow::DROP_OLDEST);
+	RunBackpressure("supersede", users, rounds, true, SIZE_MAX, Overflow::DROP_OLDEST);
+	RunBackpressure("supersede, limit users/4, drop oldest", users, rounds, true, users / 4, Overflow::DROP_OLDEST);
+	RunBackpressure("supersede, limit users/4, block", users, rounds, true, users / 4, Overflow::BLOCK);
+}
+
+/*
+ * Кольцо в разделяемой памяти между процессами: writers дочерних процессов пишут по messages
+ * сообщений со временем отправки, этот процесс читает и подтверждает. Задержка - от записи до чтения
+ * (CLOCK_MONOTONIC общий для процессов), pause - пауза писателя между сообщениями
+ */
+void RunShm(const string &name, int writers, int64_t messages, chrono::microseconds pause) {
+	const string ring_name = "/lb_bench_" + str::Str((int64_t)getpid());
+	shm::Ring::Remove(ring_name);
+	shm::Ring ring(ring_name, 1 << 20);
+	const string padding(100, 'x');
+
+	vector<pid_t> children;
+	auto begin = chrono::steady_clock::now();
+	for (int writer = 0; writer < writers; ++writer) {
+		pid_t pid = fork();
+		if (pid == 0) {
+			shm::Ring output(ring_name, 0);
+			string body;
+			for (int64_t seq = 0; seq < messages; ++seq) {
+				if (pause.count())
+					this_thread::sleep_for(pause);
+				body.clear();
+				str::Append(body, (int64_t)writer);
+				body += ' ';
+				str::Append(body, seq);
+				body += ' ';
+				str::Append(body, (int64_t)chrono::steady_clock::now().time_since_epoch().count());
+				body += ' ';
+				body += padding;
+				output.Write(body);
+			}
+			_exit(0);
+		}
+		children.push_back(pid);
+	}
+
+	vector<int64_t> next(writers, 0);
+	vector<double> lags;
+	lags.reserve(writers * messages);
+	string_view body;
+	uint64_t end = 0;
+	ring::Backoff backoff;
+	while (lags.size() < static_cast<size_t>(writers * messages)) {
+		if (!ring.Read(body, end)) {
+			backoff.Wait();
+			continue;
+		}
+		backoff.Reset();
+		int64_t now = chrono::steady_clock::now().time_since_epoch().count();
+
+		int64_t fields[3];
+		for (auto &field : fields) {
+			size_t space = body.find(' ');
+			str::ToInt64(body.substr(0, space), field);
+			body.remove_prefix(space + 1);
+		}
+		//порядок сообщений каждого писателя сохраняется
+		if (fields[1] != next[fields[0]]++)
+			throw err::Error("reordered", "shm message", str::Str(fields[1]));
+		lags.push_back((now - fields[2]) / 1000.0);
+		ring.Release(end);
+	}
+	double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+
+	for (auto pid : children)
+		waitpid(pid, nullptr, 0);
+	shm::Ring::Remove(ring_name);
+
+	sort(lags.begin(), lags.end());
+	cout << "\t" << name << ": " << lags.size() << " messages, " << str::Str(lags.size() / ms * 1000, 0)
+			<< " msg/sec, latency p50 " << str::Str(lags[lags.size() / 2], 1) << " us, p99 "
+			<< str::Str(lags[lags.size() * 99 / 100], 1) << " us" << endl;
+}
+
+void BenchShm(int64_t messages) {
+	cout << "shm: " << messages << " messages of 120 bytes per writer, 1 MB ring" << endl;
+
+	RunShm("1 writer, burst", 1, messages, chrono::microseconds(0));
+	RunShm("2 writers, burst", 2, messages, chrono::microseconds(0));
+	RunShm("1 writer, every 100 us", 1, messages / 10, chrono::microseconds(100));
+}
+
+/*
+ * Набор синтетических нагрузок на LeaderBoard и Reminder без брокера
+ *
+ * Каждая нагрузка идет в отдельном процессе (fork): пиковый RSS (VmHWM) относится только к ней
+ * и к ее замерам. Время каждой операции - steady_clock вокруг вызова, его цена (десятки нс) входит
+ * в результат, ops/sec - по сумме времени операций фазы. Подготовка таблицы не замеряется
+ *
+ * Формат вывода: text - строка на фазу, json - объект на фазу (JSON Lines) для сравнения прогонов
+ */
+struct Phase {
+	string name;
+	vector<uint32_t> lags;
+	chrono::nanoseconds total = chrono::nanoseconds(0);
+
+	Phase(const string &phase_name, int64_t ops)
+	: name(phase_name) {
+		lags.reserve(ops);
+	}
+
+	template <class Func>
+	void operator()(Func func) {
+		auto start = chrono::steady_clock::now();
+		func();
+		auto lag = chrono::steady_clock::now() - start;
+		total += lag;
+		lags.push_back(static_cast<uint32_t>(min<int64_t>(chrono::nanoseconds(lag).count(), UINT32_MAX)));
+	}
+};
+
+size_t PeakResidentSize() {
+	ifstream status("/proc/self/status");
+	string line;
+	while (getline(status, line)) {
+		if (line.compare(0, 6, "VmHWM:") == 0)
+			return str::Int64(line.substr(6, line.size() - 9)) * 1024;
+	}
+	return 0;
+}
+
+void PrintPhases(const string &workload, vector<Phase> &phases, int64_t users, const string &format) {
+	size_t peak = PeakResidentSize();
+	for (auto &phase : phases) {
+		auto &lags = phase.lags;
+		sort(lags.begin(), lags.end());
+		auto percentile = [&lags](double share) {
+			return lags.empty() ? 0 : lags[min(lags.size() - 1, static_cast<size_t>(lags.size() * share))] / 1000.0;
+		};
+		double secs = chrono::duration<double>(phase.total).count();
+		double rate = secs > 0 ? lags.size() / secs : 0;
+
+		if (format == "json") {
+			cout << "{\"workload\":\"" << workload << "\",\"phase\":\"" << phase.name << "\",\"users\":" << users
+					<< ",\"ops\":" << lags.size() << ",\"ops_per_sec\":" << str::Str(rate, 0)
+					<< ",\"p50_us\":" << str::Str(percentile(0.5), 3) << ",\"p99_us\":" << str::Str(percentile(0.99), 3)
+					<< ",\"p999_us\":" << str::Str(percentile(0.999), 3) << ",\"max_us\":" << str::Str(percentile(1), 3)
+					<< ",\"peak_rss_kb\":" << peak / 1024 << "}" << endl;
+		} else {
+			cout << "\t" << workload << " " << phase.name << ": " << lags.size() << " ops, " << str::Str(rate, 0)
+					<< " ops/sec, p50 " << str::Str(percentile(0.5), 2) << " us, p99 " << str::Str(percentile(0.99), 2)
+					<< " us, p99.9 " << str::Str(percentile(0.999), 2) << " us, max " << str::Str(percentile(1), 2)
+					<< " us, peak rss " << peak / (1 << 20) << " MB" << endl;
+		}
+	}
+}
+
+/*
+ * Распределение Ципфа на 1..count: обратная функция по таблице накопленных весов
+ */
+class Zipf {
+public:
+	Zipf(int64_t count, double exponent) {
+		m_cdf.reserve(count);
+		double sum = 0;
+		for (int64_t rank = 1; rank <= count; ++rank) {
+			sum += 1 / pow(static_cast<double>(rank), exponent);
+			m_cdf.push_back(sum);
+		}
+	}
+
+	int64_t operator()(mt19937_64 &random) {
+		double point = uniform_real_distribution<double>(0, m_cdf.back())(random);
+		return lower_bound(m_cdf.begin(), m_cdf.end(), point) - m_cdf.begin() + 1;
+	}
+private:
+	vector<double> m_cdf;
+};
+
+//таблица с пользователями 1..users и случайными суммами недели
+void FillBoard(LeaderBoard &board, int64_t users) {
+	mt19937_64 random(42);
+	uniform_int_distribution<int64_t> amount_dist(1, 1000000);
+	auto now = chrono::system_clock::now();
+	for (int64_t id = 1; id <= users; ++id) {
+		board.AddUser(id, "user" + str::Str(id));
+		board.AddWin(id, now, amount_dist(random));
+	}
+}
+
+void WorkloadUniform(vector<Phase> &phases, int64_t users, int64_t ops) {
+	LeaderBoard board;
+	Phase registered("register", users);
+	for (int64_t id = 1; id <= users; ++id)
+		registered([&]() { board.AddUser(id, "user" + str::Str(id)); });
+
+	mt19937_64 random(42);
+	uniform_int_distribution<int64_t> user_dist(1, users);
+	uniform_int_distribution<int64_t> amount_dist(1, 1000);
+	auto now = chrono::system_clock::now();
+	Phase win("win", ops);
+	for (int64_t cnt = 0; cnt < ops; ++cnt) {
+		int64_t id = user_dist(random);
+		double amount = amount_dist(random);
+		win([&]() { board.AddWin(id, now, amount); });
+	}
+
+	string stat;
+	Phase render("stat", ops);
+	for (int64_t cnt = 0; cnt < ops; ++cnt) {
+		int64_t id = user_dist(random);
+		render([&]() { stat.clear(); board.GetStatMessage(id, stat); });
+	}
+
+	phases.push_back(move(registered));
+	phases.push_back(move(win));
+	phases.push_back(move(render));
+}
+
+/*
+ * Выигрывают и смотрят статистику в основном немногие активные пользователи (показатель 1.1)
+ */
+void WorkloadZipf(vector<Phase> &phases, int64_t users, int64_t ops) {
+	LeaderBoard board;
+	FillBoard(board, users);
+
+	Zipf zipf(users, 1.1);
+	mt19937_64 random(7);
+	uniform_int_distribution<int64_t> amount_dist(1, 1000);
+	auto now = chrono::system_clock::now();
+	Phase win("win", ops);
+	for (int64_t cnt = 0; cnt < ops; ++cnt) {
+		int64_t id = zipf(random);
+		double amount = amount_dist(random);
+		win([&]() { board.AddWin(id, now, amount); });
+	}
+
+	string stat;
+	Phase render("stat", ops);
+	for (int64_t cnt = 0; cnt < ops; ++cnt) {
+		int64_t id = zipf(random);
+		render([&]() { stat.clear(); board.GetStatMessage(id, stat); });
+	}
+
+	phases.push_back(move(win));
+	phases.push_back(move(render));
+}
+
+/*
+ * Новый пользователь поднимается с последнего места на первое за ops выигрышей
+ * и после каждого смотрит свою статистику
+ */
+void WorkloadWhale(vector<Phase> &phases, int64_t users, int64_t ops) {
+	LeaderBoard board;
+	FillBoard(board, users);
+	const int64_t whale = users + 1;
+	board.AddUser(whale, "whale");
+
+	const double step = 1000001.0 / ops;
+	auto now = chrono::system_clock::now();
+	string stat;
+	Phase win("win", ops);
+	Phase render("stat", ops);
+	for (int64_t cnt = 0; cnt < ops; ++cnt) {
+		win([&]() { board.AddWin(whale, now, step); });
+		render([&]() { stat.clear(); board.GetStatMessage(whale, stat); });
+	}
+	if (stat.compare(0, 9, "User:\n1. ") != 0)
+		throw err::Error("not first", "whale");
+
+	phases.push_back(move(win));
+	phases.push_back(move(render));
+}
+
+/*
+ * Переименования случайных пользователей, между пачками по 1000 - уплотнение имен, как в простое приема
+ */
+void WorkloadRenames(vector<Phase> &phases, int64_t users, int64_t ops) {
+	LeaderBoard board;
+	FillBoard(board, users);
+
+	mt19937_64 random(11);
+	uniform_int_distribution<int64_t> user_dist(1, users);
+	Phase rename("rename", ops);
+	Phase compact("compact", ops / 1000 + 1);
+	for (int64_t cnt = 1; cnt <= ops; ++cnt) {
+		int64_t id = user_dist(random);
+		string name = RandomName(random);
+		rename([&]() { board.RenameUser(id, name); });
+
+		bool more = cnt % 1000 == 0;
+		while (more)
+			compact([&]() { more = board.CompactNames(); });
+	}
+
+	phases.push_back(move(rename));
+	phases.push_back(move(compact));
+}
+
+/*
+ * Волны подключений: по burst случайных пользователей подключаются, получают первое сообщение
+ * в ближайшем такте и отключаются. tick - весь такт, построение сообщений всех подключившихся
+ */
+void WorkloadStorm(vector<Phase> &phases, int64_t users, int64_t ops) {
+	LeaderBoard board;
+	FillBoard(board, users);
+
+	atomic<int64_t> sent(0);
+	Reminder reminder(board, [&sent](Reminder::Batch &batch, bool) {
+		sent += batch.size();
+	}, Unchanged::SEND, StatFormat::FULL);
+
+	vector<int64_t> ids(users);
+	for (int64_t id = 1; id <= users; ++id)
+		ids[id - 1] = id;
+	mt19937_64 random(13);
+	shuffle(ids.begin(), ids.end(), random);
+
+	const int64_t burst = min<int64_t>(users, 10000);
+	const int64_t rounds = max<int64_t>(1, ops / burst);
+	Phase connect("connect", rounds * burst);
+	Phase tick("tick", rounds);
+	Phase disconnect("disconnect", rounds * burst);
+
+	auto start = chrono::steady_clock::now();
+	date::SteadyTimePoint wake;
+	for (int64_t round = 0; round < rounds; ++round) {
+		auto first = ids.begin() + (round * burst) % (users - burst + 1);
+		for (auto id = first; id != first + burst; ++id)
+			connect([&]() { reminder.ConnectUser(*id); });
+		tick([&]() { reminder.Tick(start + chrono::milliseconds(round * REMINDER_TICK_MS), wake); });
+		for (auto id = first; id != first + burst; ++id)
+			disconnect([&]() { reminder.DisconnectUser(*id); });
+	}
+
+	if (sent != rounds * burst)
+		throw err::Error("lost", "storm messages", str::Str(sent.load()));
+
+	phases.push_back(move(connect));
+	phases.push_back(move(tick));
+	phases.push_back(move(disconnect));
+}
+
+/*
+ * Смена недели: образ таблицы с прошлой неделей загружается заново, первый выигрыш
+ * после загрузки сбрасывает неделю. Затем выигрыши и статистика в новой неделе
+ */
+void WorkloadRollover(vector<Phase> &phases, int64_t users, int64_t ops) {
+	LeaderBoard board;
+	FillBoard(board, users);
+
+	string image;
+	board.Save(image);
+	string_view header(image);
+	int64_t week_begin = 0;
+	int64_t week_end = 0;
+	bin::Get(header, week_begin);
+	bin::Get(header, week_end);
+	const int64_t week = chrono::duration_cast<date::SystemTimePoint::duration>(chrono::hours(24 * 7)).count();
+	string last_week;
+	bin::Put(last_week, week_begin - week);
+	bin::Put(last_week, week_end - week);
+	last_week += header;
+
+	mt19937_64 random(17);
+	uniform_int_distribution<int64_t> user_dist(1, users);
+	uniform_int_distribution<int64_t> amount_dist(1, 1000);
+	auto now = chrono::system_clock::now();
+	Phase rollover("rollover", 10);
+	for (int cnt = 0; cnt < 10; ++cnt) {
+		string_view loaded(last_week);
+		board.Load(loaded);
+		int64_t id = user_dist(random);
+		rollover([&]() { board.AddWin(id, now, amount_dist(random)); });
+	}
+
+	Phase win("win", ops);
+	for (int64_t cnt = 0; cnt < ops; ++cnt) {
+		int64_t id = user_dist(random);
+		double amount = amount_dist(random);
+		win([&]() { board.AddWin(id, now, amount); });
+	}
+
+	string stat;
+	Phase render("stat", ops);
+	for (int64_t cnt = 0; cnt < ops; ++cnt) {
+		int64_t id = user_dist(random);
+		render([&]() { stat.clear(); board.GetStatMessage(id, stat); });
+	}
+
+	phases.push_back(move(rollover));
+	phases.push_back(move(win));
+	phases.push_back(move(render));
+}
+
+typedef void (*Workload)(vector<Phase> &phases, int64_t users, int64_t ops);
+
+const vector<pair<string, Workload>> WORKLOADS = {
+	{"uniform", WorkloadUniform},
+	{"zipf", WorkloadZipf},
+	{"whale", WorkloadWhale},
+	{"renames", WorkloadRenames},
+	{"storm", WorkloadStorm},
+	{"rollover", WorkloadRollover},
+};
+
+/*
+ * Возвращает false, если процесс нагрузки завершился с ошибкой
+ */
+bool RunWorkload(const string &name, Workload workload, int64_t users, int64_t ops, const string &format) {
+	cout.flush();
+	pid_t pid = fork();
+	if (pid < 0)
+		throw err::Error("failed", "fork", name);
+
+	if (pid == 0) {
+		int code = EXIT_SUCCESS;
+		try {
+			vector<Phase> phases;
+			workload(phases, users, ops);
+			PrintPhases(name, phases, users, format);
+		} catch (const std::exception &e) {
+			cout << "\t" << name << ": " << e.what() << endl;
+			code = EXIT_FAILURE;
+		}
+		cout.flush();
+		_exit(code);
+	}
+
+	int status = 0;
+	waitpid(pid, &status, 0);
+	return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+bool BenchSuite(const string &only, int64_t users, int64_t ops, const string &format) {
+	if (format != "json")
+		cout << (only.empty() ? "suite" : only) << ": " << users << " users, " << ops << " ops" << endl;
+
+	bool success = true;
+	for (auto &workload : WORKLOADS) {
+		if (only.empty() || only == workload.first)
+			success = RunWorkload(workload.first, workload.second, users, ops, format) && success;
+	}
+	return success;
+}
+
+void PrintUsage() {
+	cout << "Usage:" << endl;
+	cout << "bench [SCENARIO] [USERS] [OPS] [FORMAT]" << endl;
+	cout << "USERS and OPS are positive, 100000 and 10000 by default; each scenario reads them as listed" << endl;
+	cout << "[SCENARIO] could be:" << endl;
+	cout << "\trank USERS OPS - LeaderBoard::AddWin on rating::Tree against the former list, OPS <= USERS" << endl;
+	cout << "\tsuite USERS OPS [FORMAT] - all synthetic workloads below, each in its own process" << endl;
+	cout << "\tuniform, zipf, whale, renames, storm, rollover USERS OPS [FORMAT] - one synthetic workload" << endl;
+	cout << "\tstat USERS OPS - stat messages for OPS random users" << endl;
+	cout << "\treminder USERS - timer wheel minute against the former list + Sleeper, USERS connected users" << endl;
+	cout << "\tproducer MESSAGES - Producer against the former queue, USERS is the message count" << endl;
+	cout << "\tparse USERS OPS - parsing OPS incoming messages for USERS users" << endl;
+	cout << "\tingest USERS OPS - OPS wins applied one by one and in batches" << endl;
+	cout << "\tpipeline USERS OPS - ingest pipeline on OPS wins and renames" << endl;
+	cout << "\trestore USERS OPS - restart from journal and from snapshot, OPS wins after the snapshot" << endl;
+	cout << "\tusers USERS OPS - user index, OPS lookups" << endl;
+	cout << "\tshm MESSAGES - shared memory ring, USERS is the message count per writer" << endl;
+	cout << "\tbackpressure USERS ROUNDS - bounded Producer queue, OPS is the number of rounds" << endl;
+	cout << "\tconnect BACKLOG CONNECTS - connect lag behind a backlog of USERS messages, OPS connects" << endl;
+	cout << "\tlag USERS - USERS users due in one tick" << endl;
+	cout << "\tunchanged USERS OPS - unchanged stat modes and formats, OPS wins per minute" << endl;
+	cout << "\tnames USERS OPS - user names, OPS renames" << endl;
+	cout << "\tmetrics USERS OPS - metrics overhead on the pipeline (OPS messages) and the wheel" << endl;
+	cout << "\tcontention USERS RENDERS - wins against concurrent renders, OPS is renders/sec" << endl;
+	cout << "[FORMAT] for synthetic workloads: text (default) or json, one object per phase" << endl;
+}
+
+int main(int argc, char *argv[]) {
+	try {
+		string scenario = argc > 1 ? argv[1] : "rank";
+		int64_t users = argc > 2 ? str::Int64(argv[2]) : 100000;
+		int64_t ops = argc > 3 ? str::Int64(argv[3]) : 10000;
+		string format = argc > 4 ? argv[4] : "text";
+		if (users <= 0 || ops <= 0 || (format != "text" && format != "json")) {
+			PrintUsage();
+			return EXIT_FAILURE;
+		}
+
+		bool workload = false;
+		for (auto &known : WORKLOADS)
+			workload = workload || scenario == known.first;
+
+		if (scenario == "rank" && ops <= users) {
+			BenchRank(users, ops);
+		} else if (scenario == "suite" || workload) {
+			if (!BenchSuite(workload ? scenario : "", users, ops, format))
+				return EXIT_FAILURE;
+		} else if (scenario == "stat") {
+			BenchStat(users, ops);
+		} else if (scenario == "reminder") {
+			BenchReminder(users);
+		} else if (scenario == "producer") {
+			BenchProducer(users);
+		} else if (scenario == "parse") {
+			BenchParse(users, ops);
+		} else if (scenario == "ingest") {
+			BenchIngest(users, ops);
+		} else if (scenario == "pipeline") {
+			BenchPipeline(users, ops);
+		} else if (scenario == "restore") {
+			BenchRestore(users, ops);
+		} else if (scenario == "users") {
+			BenchUsers(users, ops);
+		} else if (scenario == "shm") {
+			BenchShm(users);
+		} else if (scenario == "backpressure") {
+			BenchBackpressure(users, ops);
+		} else if (scenario == "connect") {
+			BenchConnect(users, ops);
+		} else if (scenario == "lag") {
+			BenchLag(users);
+		} else if (scenario == "unchanged") {
+			BenchUnchanged(users, ops);
+		} else if (scenario == "names") {
+			BenchNames(users, ops);
+		} else if (scenario == "metrics") {
+			BenchMetrics(users, ops);
+		} else if (scenario == "contention") {
+			BenchContention(users, ops);
+		} else {
+			PrintUsage();
+			return EXIT_FAILURE;
+		}
+	} catch (const std::exception &e) {
+		cout << "Unexpected error thrown: " << e.what() << endl;
+		return EXIT_FAILURE;
+	} catch (...) {
+		cout << "Unknown unexpected error thrown" << endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,66 @@
+#ifndef INCLUDE_LB_ARENA_H_
+#define INCLUDE_LB_ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace arena {
+/*
+ * Хранилище имен пользователей по номеру пользователя
+ *
+ * Имена лежат подряд в блоках по CHUNK_SIZE байт: номер владельца, длина (varint) и символы.
+ * На пользователя - 4-байтовая ссылка (номер блока и смещение), отдельных выделений памяти нет.
+ * Чтение возвращает string_view прямо в блок
+ *
+ * Переименование дописывает новое имя в конец, старое становится мусором блока.
+ * CompactStep переносит живые имена из самого замусоренного блока в конец и освобождает его -
+ * за вызов не больше одного блока, чтобы не держать блокировку надолго. CompactDue дешево
+ * отвечает, есть ли смысл пытаться: шаг уже что-то освободил или мусора прибавилось на полблока.
+ * Номер владельца в записи позволяет обойти блок, не просматривая все ссылки
+ */
+class Names {
+public:
+	static const uint32_t CHUNK_SIZE = 1 << 20;
+
+	Names();
+
+	void Add(std::string_view name);
+	void Set(uint32_t slot, std::string_view name);
+	std::string_view Get(uint32_t slot) const;
+
+	size_t Size() const;
+	size_t MemoryUsage() const;
+	size_t Garbage() const;
+
+	void Reserve(size_t count);
+	void Clear();
+	bool CompactDue() const;
+	bool CompactStep();
+private:
+	typedef uint32_t Ref;
+
+	struct Chunk {
+		std::unique_ptr<char[]> data;
+		uint32_t used;
+		uint32_t garbage;
+	};
+
+	std::vector<Ref> m_refs;
+	std::vector<Chunk> m_chunks;
+	std::vector<uint32_t> m_free_chunks;
+	uint32_t m_tail;
+	size_t m_garbage;
+	//мусор на момент последней безрезультатной попытки уплотнения
+	size_t m_checked_garbage;
+	bool m_compacting;
+
+	Ref Append(uint32_t slot, std::string_view name);
+	uint32_t NewChunk();
+	uint32_t SpanSize(Ref ref) const;
+};
+} //end of arena namespace
+
+#endif /* INCLUDE_LB_ARENA_H_ */
@@ -0,0 +1,34 @@
+#ifndef INCLUDE_LB_COMMAND_H_
+#define INCLUDE_LB_COMMAND_H_
+
+#include <string_view>
+
+#include <lb_functions.h>
+
+namespace cmd {
+enum Type {
+	USER_REGISTER,
+	USER_RENAME,
+	USER_WON,
+	USER_CONNECT,
+	USER_DISCONNECT
+};
+
+/*
+ * Разобранное входящее сообщение
+ * name указывает внутрь исходного сообщения и живет не дольше него
+ * token - метка из строки MSG_TOKEN, 0 если ее нет
+ */
+struct Command {
+	Type type;
+	int64_t id;
+	std::string_view name;
+	date::SystemTimePoint date;
+	double amount;
+	uint64_t token;
+};
+
+void Parse(std::string_view msg, Command &command);
+} //end of cmd namespace
+
+#endif /* INCLUDE_LB_COMMAND_H_ */
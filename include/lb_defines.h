@@ -1,15 +1,20 @@
 #ifndef INCLUDE_LB_DEFINES_H_
 #define INCLUDE_LB_DEFINES_H_
 
+#include <cstddef>
 #include <string>
 
 const std::string RABBITMQ_HOST = "localhost";
 
 const std::string LB_INPUT_QUEUE = "leaderboard_input";
-const std::string LB_INPUT_ROUTE = "leaderboard_input";
 
 const std::string LB_OUTPUT_QUEUE = "leaderboard_output";
-const std::string LB_OUTPUT_ROUTE = "leaderboard_output";
+
+//способ доставки сообщений по умолчанию: брокер или кольцо в разделяемой памяти
+//("/" + имя очереди) емкостью SHM_RING_SIZE байт - сервер и инструменты на одной машине
+enum class Transport { AMQP, SHM };
+const Transport LB_TRANSPORT = Transport::AMQP;
+const size_t SHM_RING_SIZE = 64 << 20;
 
 const std::string MSG_USER_REGISTER = "user_registered";
 const std::string MSG_USER_RENAME = "user_renamed";
@@ -17,6 +22,69 @@ const std::string MSG_USER_WON = "user_deal_won";
 const std::string MSG_USER_CONNECT = "user_connected";
 const std::string MSG_USER_DISCONNECT = "user_disconnected";
 
+//необязательная последняя строка входящего сообщения: метка для замера задержки (целое > 0).
+//Метки подключения и выигрыша уходят в штампе ближайшего сообщения пользователю (см. Reminder)
+const std::string MSG_TOKEN = "token:";
+
 const int MAX_NEIGHBOURS = 10;
 
+//входящий канал: сколько сообщений брокер выдает без подтверждения
+//и когда подтверждать пачку - после INPUT_BATCH_SIZE сообщений или INPUT_BATCH_TIMEOUT_US с первого
+const int INPUT_PREFETCH = 2000;
+const int INPUT_BATCH_SIZE = 1000;
+const int INPUT_BATCH_TIMEOUT_US = 2000;
+
+//конвейер входящих: число потоков разбора, размер колец между стадиями и период отчета о пропускной способности
+const int INGEST_DECODERS = 2;
+const int INGEST_RING_SIZE = 4096;
+const int INGEST_REPORT_SEC = 10;
+
+//метрики процесса (сервер с --metrics): файл отчета, период его перезаписи
+//и доля замеряемых по времени частых событий - одно из METRICS_SAMPLE (степень двойки)
+const std::string METRICS_FILE = "leaderboard_metrics";
+const int METRICS_REPORT_SEC = 1;
+const int METRICS_SAMPLE = 16;
+
+//трассировка (сборка с make TRACE=1): событий в кольце каждого потока и файл, в который
+//кольца сбрасываются по SIGUSR1
+const size_t TRACE_RING_SIZE = 1 << 16;
+const std::string TRACE_FILE = "leaderboard_trace.json";
+
+//каталог снимка и журнала, период снимков и fdatasync журнала перед подтверждением брокеру
+const std::string STORAGE_DIR = "leaderboard_data";
+const int STORAGE_SNAPSHOT_SEC = 10 * 60;
+const bool STORAGE_SYNC = false;
+
+//период рассылки статистики подключенным пользователям и шаг колеса таймеров Reminder
+const int REMINDER_PERIOD_MS = 60 * 1000;
+const int REMINDER_TICK_MS = 100;
+const int REMINDER_SLOTS = REMINDER_PERIOD_MS / REMINDER_TICK_MS;
+
+//потоки построения сообщений наступивших тактов (вместе с потоком Reminder) и размер отрезка
+//пользователей, который берет поток, - готовые сообщения отрезка уходят в очередь одной пачкой
+const int REMINDER_WORKERS = 2;
+const int REMINDER_BATCH_SIZE = 64;
+
+//полосы выходной очереди: за раунд публикуется до веса * PRODUCER_ROUND_SIZE сообщений каждой полосы -
+//первых сообщений после подключения (HIGH) и периодической рассылки (BULK)
+const int PRODUCER_HIGH_WEIGHT = 4;
+const int PRODUCER_BULK_WEIGHT = 1;
+const int PRODUCER_ROUND_SIZE = 64;
+
+//граница выходной очереди в сообщениях и что делать при переполнении:
+//выбросить самое старое (пользователь получит полную статистику в следующий раз) или ждать
+enum class Overflow { DROP_OLDEST, BLOCK };
+const size_t PRODUCER_QUEUE_LIMIT = 200000;
+const Overflow PRODUCER_OVERFLOW = Overflow::DROP_OLDEST;
+
+//что делать, если с прошлой отправки статистика пользователя не изменилась:
+//отправить заново, пропустить или отправить короткое сообщение "без изменений"
+enum class Unchanged { SEND, SKIP, HEARTBEAT };
+const Unchanged REMINDER_UNCHANGED = Unchanged::SEND;
+
+//формат рассылки: каждый раз полная статистика или только изменившиеся строки
+//(полная - при подключении и после смены недели)
+enum class StatFormat { FULL, DELTA };
+const StatFormat REMINDER_FORMAT = StatFormat::FULL;
+
 #endif /* INCLUDE_LB_DEFINES_H_ */
@@ -2,28 +2,56 @@
 #define INCLUDE_LB_FUNCTIONS_H_
 
 #include <string>
+#include <string_view>
 #include <chrono>
+#include <cstring>
+
+void Debug(const std::string &msg);
 
 namespace str {
 std::string GetWord(std::string &src, char delimiter);
+std::string_view NextWord(std::string_view &src, char delimiter);
 int64_t Int64(const std::string &val);
+bool ToInt64(std::string_view val, int64_t &res);
+bool ToDouble(std::string_view val, double &res);
 std::string Str(int64_t val);
 double Double(const std::string &val);
 std::string Str(double val, int precision);
+void Append(std::string &dst, int64_t val);
+void Append(std::string &dst, double val, int precision);
 } //end of str namespace
 
 namespace test {
-bool Numeric(const std::string &data);
-bool Username(const std::string &data);
+bool Numeric(std::string_view data);
+bool Username(std::string_view data);
 } //end of test namespace
 
+/*
+ * Двоичная сериализация простых типов для снимков и журнала: байты как в памяти, без преобразований
+ */
+namespace bin {
+template <class T>
+void Put(std::string &dst, const T &val) {
+	dst.append(reinterpret_cast<const char *>(&val), sizeof(T));
+}
+
+template <class T>
+bool Get(std::string_view &src, T &val) {
+	if (src.size() < sizeof(T))
+		return false;
+	std::memcpy(&val, src.data(), sizeof(T));
+	src.remove_prefix(sizeof(T));
+	return true;
+}
+} //end of bin namespace
+
 namespace date {
 typedef std::chrono::time_point<std::chrono::system_clock> SystemTimePoint;
 typedef std::chrono::time_point<std::chrono::steady_clock> SteadyTimePoint;
 typedef std::chrono::duration<int, std::milli> MillisecondsDuration;
 
 std::string Format(const SystemTimePoint &time, const std::string &format = "%F %H:%M:%S");
-SystemTimePoint FromString(const std::string &date);
+SystemTimePoint FromString(std::string_view date);
 SystemTimePoint GetWeekBegin();
 SystemTimePoint GetWeekEnd();
 SystemTimePoint MinuteLater();
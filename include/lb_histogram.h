@@ -0,0 +1,44 @@
+#ifndef INCLUDE_LB_HISTOGRAM_H_
+#define INCLUDE_LB_HISTOGRAM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace hist {
+/*
+ * Гистограмма задержек с постоянной относительной точностью (как HdrHistogram)
+ * Значения до 2^SUB_BITS учитываются точно, дальше каждый интервал [2^k, 2^(k+1))
+ * делится на 2^SUB_BITS корзин - погрешность не больше 1/128 значения на всем диапазоне uint64
+ *
+ * Память постоянная (около 60 КБ), Add - без выделений и ветвлений по размеру данных.
+ * Гистограммы потоков складываются Merge, перцентиль - верхняя граница корзины
+ */
+class Histogram {
+public:
+	static const int SUB_BITS = 7;
+
+	Histogram();
+
+	void Add(uint64_t value, uint64_t count = 1);
+	void Merge(const Histogram &other);
+	void Clear();
+
+	uint64_t Count() const;
+	uint64_t Max() const;
+	double Mean() const;
+	uint64_t Percentile(double share) const;
+
+	//для счетчиков корзин вне гистограммы (см. metrics)
+	static size_t Buckets();
+	static size_t Bucket(uint64_t value);
+	static uint64_t Highest(size_t bucket);
+private:
+	std::vector<uint64_t> m_counts;
+	uint64_t m_count;
+	uint64_t m_sum;
+	uint64_t m_max;
+};
+} //end of hist namespace
+
+#endif /* INCLUDE_LB_HISTOGRAM_H_ */
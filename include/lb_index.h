@@ -0,0 +1,59 @@
+#ifndef INCLUDE_LB_INDEX_H_
+#define INCLUDE_LB_INDEX_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace flat {
+/*
+ * Хеш-индекс внешнего id в плотный внутренний номер (слот)
+ * Открытая адресация с линейным пробированием: корзины лежат одним массивом,
+ * поиск обычно укладывается в одну-две строки кэша. Хеш - фибоначчиево умножение
+ *
+ * Корзина - 8 байт: слот и старшие 32 бита хеша. По ним же вычисляется начальная корзина,
+ * поэтому перестроение не читает id, а сами id сравниваются только при совпадении хеша.
+ * id хранятся плотным массивом по номеру слота, данные пользователей - у вызывающего
+ * в таких же массивах. Удаление - обратным сдвигом, без "надгробий"
+ */
+class Index {
+public:
+	static constexpr uint32_t NONE = UINT32_MAX;
+
+	Index();
+
+	uint32_t Find(int64_t id) const;
+	bool Insert(int64_t id, uint32_t slot);
+	uint32_t Erase(int64_t id);
+	int64_t Id(uint32_t slot) const;
+
+	size_t Size() const;
+	size_t MemoryUsage() const;
+	void Reserve(size_t count);
+	void Clear();
+
+	template <class Func>
+	void ForEach(Func func) const {
+		for (auto &bucket : m_buckets) {
+			if (bucket.slot != NONE)
+				func(m_ids[bucket.slot], bucket.slot);
+		}
+	}
+private:
+	struct Bucket {
+		uint32_t slot;
+		uint32_t hash;
+	};
+
+	std::vector<Bucket> m_buckets;
+	std::vector<int64_t> m_ids;
+	size_t m_size;
+	int m_shift;
+
+	static uint32_t Hash(int64_t id);
+	size_t Home(uint32_t hash) const;
+	void Rehash(size_t capacity);
+};
+} //end of flat namespace
+
+#endif /* INCLUDE_LB_INDEX_H_ */
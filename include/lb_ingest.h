@@ -0,0 +1,97 @@
+#ifndef INCLUDE_LB_INGEST_H_
+#define INCLUDE_LB_INGEST_H_
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <lb_command.h>
+#include <lb_error.h>
+#include <lb_leaderboard.h>
+#include <lb_reminder.h>
+#include <lb_ring.h>
+#include <lb_storage.h>
+
+/*
+ * Конвейер обработки входящих сообщений
+ *
+ * Поток приема (вызывающий Push) раздает сырые сообщения по кругу воркерам разбора,
+ * каждый воркер разбирает и валидирует их в cmd::Command, единственный поток применения
+ * забирает результаты в том же порядке по кругу и меняет LeaderBoard и Reminder.
+ * Между стадиями - Spsc-кольца, порядок сообщений (в том числе для каждого пользователя) сохраняется
+ *
+ * Тело сообщения не копируется: owner держит буфер живым до применения команды
+ *
+ * Если задан storage, примененные команды пишутся в журнал, а Applied() продвигается
+ * только после сброса журнала - подтвержденное брокеру переживет перезапуск
+ */
+class Ingest {
+public:
+	struct Raw {
+		std::shared_ptr<const void> owner;
+		std::string_view body;
+	};
+
+	Ingest(LeaderBoard &board, Reminder &reminder, Storage *storage, int decoders);
+	~Ingest();
+
+	void Restore();
+	void Start();
+	void Stop();
+
+	uint64_t Push(Raw &&raw);
+	uint64_t Applied() const;
+
+	void Report();
+private:
+	struct Record {
+		Raw raw;
+		cmd::Command command;
+		bool valid;
+	};
+
+	//счетчики стадии, пишет только поток стадии
+	struct Counters {
+		alignas(64) std::atomic<uint64_t> processed;
+		std::atomic<uint64_t> stalls;
+		uint64_t reported;
+		Counters() : processed(0), stalls(0), reported(0) {}
+	};
+
+	LeaderBoard &m_board;
+	Reminder &m_reminder;
+	Storage *m_storage;
+
+	std::vector<std::unique_ptr<ring::Spsc<Raw>>> m_raw;
+	std::vector<std::unique_ptr<ring::Spsc<Record>>> m_decoded;
+
+	std::vector<std::thread> m_threads;
+	std::atomic_bool m_stopped;
+	//ошибка журнала, только поток применения
+	bool m_failed;
+
+	uint64_t m_pushed;
+	std::atomic<uint64_t> m_applied;
+	std::vector<LeaderBoard::Win> m_wins;
+	//id и MSG_TOKEN выигрышей пачки
+	std::vector<std::pair<int64_t, uint64_t>> m_tokens;
+
+	Counters m_push_counters;
+	std::vector<std::unique_ptr<Counters>> m_decode_counters;
+	Counters m_apply_counters;
+	std::chrono::steady_clock::time_point m_reported;
+
+	void Decode(size_t worker);
+	void Apply();
+	void Publish(uint64_t applied);
+	void Fail(const err::Error &e);
+	bool Process(const cmd::Command &command);
+	bool ApplyCommand(const cmd::Command &command);
+	void FlushWins();
+};
+
+#endif /* INCLUDE_LB_INGEST_H_ */
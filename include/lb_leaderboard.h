@@ -0,0 +1,112 @@
+#ifndef INCLUDE_LB_LEADERBOARD_H_
+#define INCLUDE_LB_LEADERBOARD_H_
+
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <lb_arena.h>
+#include <lb_defines.h>
+#include <lb_functions.h>
+#include <lb_index.h>
+#include <lb_rating.h>
+
+/*
+ * Класс, занимающийся ведением лидерборда
+ * Хранилище пользователей - индекс id -> номер (flat::Index) и имена по номеру в блоках (arena::Names)
+ * Хранилище выигрышей - дерево порядковых статистик (rating::Tree)
+ * Номер пользователя совпадает с Handle его узла в дереве: пользователи не удаляются,
+ * и дерево, и массивы растут по одному элементу на регистрацию
+ * Место в рейтинге вычисляется деревом за логарифм, а не хранится в узлах
+ *
+ * Доступ разделяемый: построение статистики идет параллельно под shared-блокировкой,
+ * изменения таблицы - под эксклюзивной
+ *
+ * Блок лидеров одинаков для всех пользователей, поэтому хранится отрендеренным.
+ * Изменения, затрагивающие первые MAX_NEIGHBOURS мест, увеличивают версию блока,
+ * блок перестраивается первым построением статистики в новой версии
+ *
+ * Сообщение пишется в буфер вызывающего без временных строк, поток отправки переиспользует свой буфер
+ * Отпечаток - хеш всего, что видно в сообщении: места, сумм и имен окна соседей и версии блока лидеров.
+ * Он считается обходом тех же узлов без форматирования, и при совпадении сообщение не строится
+ *
+ * View - то, что пользователь получил последним: хеши строк блока лидеров и окна соседей по местам.
+ * GetStatDelta сравнивает его с текущим и выводит только строки изменившихся, новых и ушедших мест:
+ *   Delta:
+ *   User: <место>
+ *   <место>. <имя> (id:<id>)  <сумма>
+ *   <место>. -
+ * Пустой View или другая неделя - полное сообщение
+ *
+ * Save/Load - образ таблицы для снимка (см. Storage)
+ */
+class LeaderBoard {
+public:
+	struct Win {
+		int64_t id;
+		date::SystemTimePoint date;
+		double amount;
+	};
+
+	struct View {
+		int64_t week;
+		int64_t place;
+		uint64_t leaders[MAX_NEIGHBOURS];
+		uint64_t window[2 * MAX_NEIGHBOURS + 1];
+	};
+
+	LeaderBoard();
+
+	bool HasUser(const int64_t id) const;
+	void AssertUser(const int64_t id) const;
+
+	std::string GetStatMessage(const int64_t id);
+	void GetStatMessage(const int64_t id, std::string &result);
+	bool GetStatMessage(const int64_t id, std::string &result, uint64_t &fingerprint);
+	bool GetStatDelta(const int64_t id, std::string &result, View &view);
+
+	void AddUser(const int64_t id, std::string_view name);
+	void RenameUser(const int64_t id, std::string_view new_name);
+	void AddWin(const int64_t id, const date::SystemTimePoint &date, double amount);
+	void AddWins(std::vector<Win> &wins);
+
+	bool CompactNames();
+
+	void Save(std::string &image) const;
+	void Load(std::string_view &image);
+private:
+	date::SystemTimePoint m_week_begin;
+	date::SystemTimePoint m_week_end;
+
+	flat::Index m_users;
+	arena::Names m_names;
+	rating::Tree m_board;
+
+	mutable std::shared_mutex m_mutex;
+
+	//блок лидеров строят писатели под эксклюзивной блокировкой (PublishLeaders), читатели только читают
+	uint64_t m_leaders_version;
+	uint64_t m_leaders_block_version;
+	std::string m_leaders_block;
+
+	rating::Handle FindUser(const int64_t id) const;
+	void CheckWeeklyDrop();
+	void CheckWeeklyDrop(std::shared_lock<std::shared_mutex> &cs);
+
+	void ApplyWin(rating::Handle user_pos, double amount);
+	bool IsLeader(rating::Handle user_pos) const;
+	void PublishLeaders();
+	void AppendLeaders(std::string &result) const;
+
+	void RenderStat(rating::Handle user_pos, std::string &result) const;
+	uint64_t Fingerprint(rating::Handle user_pos) const;
+	uint64_t RowHash(rating::Handle user_pos) const;
+	void FillView(rating::Handle user_pos, View &view, rating::Handle *leaders, rating::Handle *window) const;
+	void AppendLine(std::string &dst, rating::Handle user_pos, int64_t place) const;
+
+	void DebugContents() const;
+};
+
+#endif /* INCLUDE_LB_LEADERBOARD_H_ */
@@ -0,0 +1,61 @@
+#ifndef INCLUDE_LB_METRICS_H_
+#define INCLUDE_LB_METRICS_H_
+
+#include <cstdint>
+#include <string>
+
+#include <lb_functions.h>
+
+namespace metrics {
+/*
+ * Метрики процесса: распределения задержек и размеров по местам замера
+ */
+enum Metric {
+	//применение команды, нс. Выигрыши замеряются пачкой: каждому записывается среднее по его пачке
+	//(apply_won_batch_avg_ns), так что распределение - по пачкам, а не по отдельным выигрышам
+	APPLY_REGISTER,
+	APPLY_RENAME,
+	APPLY_WON,
+	APPLY_CONNECT,
+	APPLY_DISCONNECT,
+	//построение сообщения статистики одного пользователя, нс
+	RENDER,
+	//пользователей в такте и опоздание обработки самого старого такта от его времени, мкс
+	REMINDER_DUE,
+	REMINDER_LATENESS,
+	//длина очереди Producer перед раундом, время сообщения в очереди до публикации (мкс) и публикация раунда (нс)
+	PRODUCER_QUEUE,
+	PRODUCER_DELAY,
+	PUBLISH,
+	METRICS
+};
+
+/*
+ * Запись - без блокировок: у каждого потока свои счетчики корзин гистограмм (см. hist::Histogram),
+ * их пишет только этот поток, а отчет читает атомарно и складывает потоки между собой.
+ * Блокировка - только при первой записи потока и при отчете
+ *
+ * До Enable запись ничего не делает. Время частых событий замеряется выборочно - одно событие
+ * или одна пачка из METRICS_SAMPLE (Sample), чтобы чтение часов не добавляло заметной нагрузки
+ */
+void Enable();
+void Disable();
+bool Enabled();
+bool Sample();
+
+void Add(Metric metric, uint64_t value, uint64_t count = 1);
+
+//время с begin в нс или мкс
+uint64_t Nanoseconds(const date::SteadyTimePoint &begin);
+uint64_t Microseconds(const date::SteadyTimePoint &begin);
+
+/*
+ * Отчет за время с прошлого отчета: по строке на метрику с записями -
+ * имя, число за интервал и всего, в секунду, p50, p99, p99.9 и max за интервал
+ */
+std::string Report();
+//отчет в файл целиком: пишется рядом и переименовывается
+void Write(const std::string &path);
+} //end of metrics namespace
+
+#endif /* INCLUDE_LB_METRICS_H_ */
@@ -0,0 +1,118 @@
+#ifndef INCLUDE_LB_PRODUCER_H_
+#define INCLUDE_LB_PRODUCER_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <lb_defines.h>
+#include <lb_functions.h>
+#include <lb_index.h>
+
+/*
+ * Класс, занимающийся непосредственно рассылкой сообщений - выходной канал связи
+ *
+ * Очередь под коротким mutex: AddMessage только дописывает в нее, поток отправки забирает
+ * раунд сообщений и публикует его уже без блокировки, поэтому добавление не ждет сетевого ввода-вывода
+ *
+ * Полос две: HIGH - первые сообщения после подключения, BULK - периодическая рассылка.
+ * Публикация идет раундами: до weight * PRODUCER_ROUND_SIZE сообщений каждой полосы, начиная с HIGH.
+ * Поэтому сообщение о подключении ждет не весь накопленный хвост рассылки, а не больше одного раунда
+ *
+ * Очередь ограничена limit сообщениями. Сообщения со статистикой знают своего пользователя:
+ * новое полное сообщение заменяет еще не отправленное полное или "без изменений" того же пользователя
+ * на его месте в очереди, "без изменений" при уже стоящем в очереди сообщении не нужно вовсе.
+ * Полное сообщение из HIGH не встает на место в BULK - стоящее там снимается, новое идет в HIGH.
+ * Разностное сообщение зависит от предыдущих, поэтому не заменяется и не заменяет.
+ * При переполнении по Overflow выбрасывается самое старое сообщение (сначала из BULK),
+ * и о пользователе сообщается Dropped, или добавление ждет, пока очередь освободится
+ */
+class Producer {
+public:
+	typedef std::vector<std::string> Batch;
+	typedef std::function<void(const Batch &)> Publisher;
+	typedef std::function<void(int64_t user)> Dropped;
+
+	struct Message {
+		enum Kind {
+			OTHER,
+			FULL,
+			HEARTBEAT,
+			DELTA
+		};
+
+		int64_t user;
+		Kind kind;
+		std::string body;
+	};
+	typedef std::vector<Message> Messages;
+
+	enum Lane {
+		HIGH,
+		BULK,
+		LANES
+	};
+
+	struct Counters {
+		uint64_t queued;
+		uint64_t max_queued;
+		uint64_t superseded;
+		uint64_t dropped;
+		uint64_t blocked;
+	};
+
+	Producer(const Publisher &publisher, int high_weight = PRODUCER_HIGH_WEIGHT, int bulk_weight = PRODUCER_BULK_WEIGHT,
+			size_t limit = PRODUCER_QUEUE_LIMIT, Overflow overflow = PRODUCER_OVERFLOW);
+
+	void OnDropped(const Dropped &dropped);
+
+	void AddMessage(const std::string &msg, Lane lane = BULK);
+	void AddMessage(std::string &&msg, Lane lane = BULK);
+	void AddMessages(Messages &messages, Lane lane = BULK);
+
+	void SendMessages();
+	void Stop();
+
+	Counters GetCounters();
+	void Report();
+private:
+	Publisher m_publisher;
+	Dropped m_dropped;
+	size_t m_quota[LANES];
+	const size_t m_limit;
+	const Overflow m_overflow;
+
+	bool m_stopped;
+	std::mutex m_data_mutex;
+	std::condition_variable m_can_process;
+	std::condition_variable m_can_add;
+
+	//сообщения лежат в пуле, полосы - очереди номеров в нем
+	std::vector<Message> m_items;
+	//время постановки в очередь, по номеру в пуле - для метрик. Пустое - сообщение не замеряется
+	std::vector<date::SteadyTimePoint> m_queued_at;
+	//полоса, в которой стоит сообщение, по номеру в пуле. LANES - снято заменой,
+	//номер остается в полосе, пока его не пропустит Take
+	std::vector<Lane> m_item_lanes;
+	size_t m_removed;
+	std::vector<uint32_t> m_free_items;
+	std::deque<uint32_t> m_lanes[LANES];
+	//пользователь -> его заменяемое сообщение в очереди
+	flat::Index m_users;
+
+	uint64_t m_max_queued;
+	uint64_t m_superseded;
+	uint64_t m_dropped_count;
+	uint64_t m_blocked;
+
+	bool Push(std::unique_lock<std::mutex> &cs, Message &&msg, Lane lane, const date::SteadyTimePoint &queued,
+			std::vector<int64_t> &dropped);
+	uint32_t Take(Lane lane);
+	size_t Size() const;
+};
+
+#endif /* INCLUDE_LB_PRODUCER_H_ */
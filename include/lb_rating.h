@@ -0,0 +1,75 @@
+#ifndef INCLUDE_LB_RATING_H_
+#define INCLUDE_LB_RATING_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace rating {
+typedef uint32_t Handle;
+const Handle NIL = UINT32_MAX;
+
+/*
+ * Дерево порядковых статистик (декартово дерево с размерами поддеревьев)
+ * Элементы упорядочены по возрастанию (эпохи, суммы выигрыша), при равных суммах
+ * ниже стоит тот, кто достиг суммы позже
+ *
+ * Эпоха - номер недели, в которой сумма была набрана. Сумма из прошлой эпохи читается как 0,
+ * поэтому недельный сброс - это просто смена текущей эпохи. Порядок узлов при этом не меняется:
+ * все устаревшие суммы оказываются ниже любой суммы текущей эпохи и сохраняют прежний взаимный порядок
+ *
+ * Узлы хранятся в векторе, Handle - индекс узла, не меняется за время жизни дерева
+ * Место (1 - лучшее) вычисляется из размеров поддеревьев, а не хранится в узле
+ *
+ * Образ для снимка - узлы как есть, загрузка - одно копирование без перестроения дерева
+ */
+class Tree {
+public:
+	Tree();
+
+	Handle Add(double amount);
+	void Update(Handle h, double amount);
+	void NextEpoch();
+
+	double Amount(Handle h) const;
+	int64_t Place(Handle h) const;
+	size_t Size() const;
+
+	Handle Top() const;
+	Handle Bottom() const;
+	Handle Better(Handle h) const;
+	Handle Worse(Handle h) const;
+
+	void Save(std::string &image) const;
+	void Load(std::string_view &image);
+private:
+	struct Node {
+		double amount;
+		uint64_t seq;
+		uint32_t epoch;
+		Handle left;
+		Handle right;
+		Handle parent;
+		uint32_t size;
+		uint32_t priority;
+	};
+
+	std::vector<Node> m_nodes;
+	Handle m_root;
+	uint64_t m_seq;
+	uint32_t m_epoch;
+	uint32_t m_random;
+
+	bool Less(Handle a, Handle b) const;
+	uint32_t SizeOf(Handle h) const;
+	uint32_t NextPriority();
+
+	void Rotate(Handle h);
+	void Link(Handle h);
+	void Unlink(Handle h);
+};
+} //end of rating namespace
+
+#endif /* INCLUDE_LB_RATING_H_ */
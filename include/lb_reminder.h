@@ -0,0 +1,177 @@
+#ifndef INCLUDE_LB_REMINDER_H_
+#define INCLUDE_LB_REMINDER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <lb_defines.h>
+#include <lb_functions.h>
+#include <lb_index.h>
+#include <lb_leaderboard.h>
+#include <lb_producer.h>
+
+/*
+ * Класс, занимающийся планированием рассылки сообщений
+ * Содержит таблицу подключенных пользователей (flat::Index id -> запись) и колесо таймеров
+ *
+ * Колесо - REMINDER_SLOTS слотов по REMINDER_TICK_MS, один оборот равен периоду рассылки.
+ * Каждый пользователь лежит в слоте такта, в который ему последний раз отправлено сообщение,
+ * и после отправки остается в нем же - следующий раз слот будет обработан ровно через оборот.
+ * Все периоды одинаковы и не длиннее оборота, поэтому иерархия колес не нужна
+ *
+ * Слоты - интрузивные двусвязные списки на индексах, подключение и отключение - O(1)
+ * Новые подключения попадают в отдельный слот "сейчас" и обрабатываются в ближайший такт
+ *
+ * За одно пробуждение обрабатываются все пользователи наступивших тактов.
+ * Отдельный поток для ожидания не нужен - ожидание прерывается condition_variable
+ *
+ * В каждой записи хранится отпечаток последней отправленной статистики (см. LeaderBoard).
+ * Если он не изменился, сообщение не строится, а поступают по режиму Unchanged.
+ * Подключение всегда получает полное сообщение, как и пользователь после Resync - например,
+ * если его сообщение выброшено из переполненной очереди. Новые подключения строятся первыми в такте
+ * и передаются отправителю отдельными пачками с признаком connected
+ *
+ * В формате StatFormat::DELTA для каждой записи хранится последний отправленный View,
+ * и рассылаются только изменившиеся строки (см. LeaderBoard::GetStatDelta)
+ *
+ * Сообщения наступивших тактов строятся параллельно: поток Tick и пул из workers - 1 потоков
+ * разбирают отрезки по REMINDER_BATCH_SIZE пользователей через общий атомарный счетчик.
+ * Готовые сообщения отрезка передаются отправителю одной пачкой - Sender вызывается из разных потоков
+ *
+ * После EnableStamps каждое сообщение заканчивается строкой для замера задержек:
+ *   Stamp: <c|p> <метка> <назначено> <в очереди>
+ * c - первое сообщение после подключения, p - периодическое. Назначено - время подключения или
+ * наступления такта пользователя, в очереди - передачи пачки отправителю, оба в мкс system_clock.
+ * Метка - из последнего user_connected или примененного user_deal_won пользователя с MSG_TOKEN
+ * (см. Tag), уходит один раз; 0 - метки не было
+ */
+class Reminder {
+public:
+	typedef Producer::Messages Batch;
+	//может забрать строки из пачки. Вызывается из нескольких потоков одновременно,
+	//connected - первые сообщения после подключения, их стоит отправить раньше остальных
+	typedef std::function<void(Batch &, bool connected)> Sender;
+
+	struct Counters {
+		uint64_t sent;
+		uint64_t unchanged;
+		uint64_t bytes;
+	};
+
+	Reminder(LeaderBoard &board, const Sender &sender, Unchanged unchanged = REMINDER_UNCHANGED,
+			StatFormat format = REMINDER_FORMAT, int workers = REMINDER_WORKERS);
+	~Reminder();
+
+	void ConnectUser(const int64_t id, uint64_t token = 0);
+	void DisconnectUser(const int64_t id);
+	void Resync(const int64_t id);
+	void Tag(const int64_t id, uint64_t token);
+	void EnableStamps();
+
+	void Save(std::string &image);
+	void Load(std::string_view &image);
+
+	void Process();
+	size_t Tick(const date::SteadyTimePoint &now, date::SteadyTimePoint &wake);
+	void Stop();
+
+	Counters GetCounters() const;
+	void Report();
+private:
+	static constexpr uint32_t NIL = UINT32_MAX;
+
+	struct ReminderDesc {
+		int64_t id;
+		uint64_t fingerprint;
+		//отправленное могло не дойти - следующее сообщение полное, итог текущего такта не запоминается
+		bool resync;
+		uint32_t prev;
+		uint32_t next;
+		uint32_t slot;
+	};
+
+	struct Due {
+		int64_t id;
+		uint64_t fingerprint;
+		bool changed;
+		bool connected;
+		//только со штампами: назначенное время (мкс system_clock) и метка
+		int64_t scheduled;
+		uint64_t token;
+	};
+
+	struct Stamp {
+		int64_t connected;
+		uint64_t token;
+	};
+
+	LeaderBoard &m_board;
+	Sender m_sender;
+	const Unchanged m_unchanged;
+	const StatFormat m_format;
+
+	flat::Index m_users;
+	std::vector<ReminderDesc> m_reminders;
+	//только для StatFormat::DELTA, по номеру записи
+	std::vector<LeaderBoard::View> m_views;
+	//только после EnableStamps, по номеру записи
+	std::vector<Stamp> m_stamps;
+	bool m_stamped;
+	std::vector<uint32_t> m_free;
+
+	//REMINDER_SLOTS слотов колеса и последний - слот новых подключений
+	std::vector<uint32_t> m_slots;
+	const uint32_t m_connected_slot;
+
+	date::SteadyTimePoint m_start;
+	int64_t m_cursor;
+
+	std::mutex m_data_mutex;
+	std::condition_variable m_can_process;
+	std::atomic_bool m_stopped;
+
+	std::atomic<uint64_t> m_sent;
+	std::atomic<uint64_t> m_unchanged_count;
+	std::atomic<uint64_t> m_bytes;
+
+	//текущее задание пула: due и View одного Tick
+	std::vector<Due> *m_job_due;
+	std::vector<LeaderBoard::View> *m_job_views;
+	std::atomic<size_t> m_job_next;
+	//сколько пользователей задания получили новый отпечаток или View - их нужно запомнить в Tick
+	std::atomic<size_t> m_job_changed;
+	uint64_t m_job_generation;
+	size_t m_job_active;
+	bool m_pool_stopped;
+	std::mutex m_pool_mutex;
+	std::condition_variable m_pool_start;
+	std::condition_variable m_pool_done;
+	std::vector<std::thread> m_workers;
+	//потоков построения вместе с вызывающим Tick
+	const int m_pool_size;
+
+	size_t RenderAll(std::vector<Due> &due, std::vector<LeaderBoard::View> &views);
+	void RenderJob();
+	void Render(Due &user, LeaderBoard::View *view, std::string &message, Batch &batch);
+	void StampMessage(const Due &user, std::string &message) const;
+	void Send(Batch &batch, bool connected);
+	void StartPool();
+	void Work();
+
+	int64_t TickOf(const date::SteadyTimePoint &time) const;
+	date::SteadyTimePoint NextWake() const;
+
+	void Link(uint32_t reminder, uint32_t slot);
+	void Unlink(uint32_t reminder);
+
+	void DebugContents() const;
+};
+
+#endif /* INCLUDE_LB_REMINDER_H_ */
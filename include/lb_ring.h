@@ -0,0 +1,86 @@
+#ifndef INCLUDE_LB_RING_H_
+#define INCLUDE_LB_RING_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace ring {
+/*
+ * Кольцевой буфер фиксированного размера для одного писателя и одного читателя без блокировок
+ * Размер округляется вверх до степени двойки
+ */
+template <class T>
+class Spsc {
+public:
+	explicit Spsc(size_t capacity)
+	: m_head(0)
+	, m_tail(0) {
+		size_t size = 1;
+		while (size < capacity)
+			size <<= 1;
+		m_items.resize(size);
+		m_mask = size - 1;
+	}
+
+	bool Push(T &&item) {
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail - m_head.load(std::memory_order_acquire) > m_mask)
+			return false;
+
+		m_items[tail & m_mask] = std::move(item);
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool Pop(T &item) {
+		size_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tail.load(std::memory_order_acquire))
+			return false;
+
+		item = std::move(m_items[head & m_mask]);
+		m_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	size_t Size() const {
+		return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+	}
+private:
+	std::vector<T> m_items;
+	size_t m_mask;
+
+	//писатель и читатель не должны делить строку кэша
+	alignas(64) std::atomic<size_t> m_head;
+	alignas(64) std::atomic<size_t> m_tail;
+};
+
+/*
+ * Ожидание для опрашивающих потоков: сначала повторяем сразу, потом уступаем процессор, потом спим
+ */
+class Backoff {
+public:
+	Backoff() : m_count(0) {}
+
+	void Wait() {
+		++m_count;
+		if (m_count <= 16)
+			return;
+		if (m_count <= 64)
+			std::this_thread::yield();
+		else
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+	}
+
+	void Reset() {
+		m_count = 0;
+	}
+private:
+	int m_count;
+};
+} //end of ring namespace
+
+#endif /* INCLUDE_LB_RING_H_ */
@@ -0,0 +1,62 @@
+#ifndef INCLUDE_LB_SHM_H_
+#define INCLUDE_LB_SHM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace shm {
+/*
+ * Кольцо сообщений в разделяемой памяти (POSIX shm) для процессов на одной машине
+ * Писателей может быть сколько угодно (в том числе в разных процессах), читатель - один
+ *
+ * Запись - заголовок 16 байт (позиция-отметка готовности и длина) и тело, выровненные на 16 байт.
+ * Писатель резервирует место сдвигом хвоста (CAS), копирует тело и только потом ставит отметку -
+ * поэтому читатель видит запись целиком или не видит вовсе. Отметка - абсолютная позиция записи + 1,
+ * она не повторяется на следующем круге, и обнулять прочитанное не нужно.
+ * Запись не разрывается на краю буфера: остаток до края занимает пустая запись-заполнитель
+ *
+ * Чтение не копирует тело - string_view указывает прямо в сегмент. Место освобождается
+ * только явным Release до конца прочитанной записи, поэтому тело живо до подтверждения обработки.
+ * Неосвобожденное переживает перезапуск читателя и будет прочитано им заново
+ *
+ * Сегмент создает тот, кто открыл его первым, с емкостью capacity; остальные берут емкость из сегмента
+ *
+ * Писатель, умерший между резервированием и отметкой, останавливает чтение навсегда: длина его записи
+ * не записана, перешагнуть ее нельзя. Восстановление - только удалением сегмента (Remove)
+ */
+class Ring {
+public:
+	Ring(const std::string &name, size_t capacity);
+	~Ring();
+
+	Ring(const Ring &) = delete;
+	Ring &operator=(const Ring &) = delete;
+
+	bool TryWrite(std::string_view body);
+	void Write(std::string_view body);
+
+	bool Read(std::string_view &body, uint64_t &end);
+	void Release(uint64_t end);
+
+	size_t Capacity() const;
+	size_t Size() const;
+
+	static void Remove(const std::string &name);
+private:
+	struct Header;
+	struct Record;
+
+	Header *m_header;
+	char *m_data;
+	size_t m_mapped;
+	uint64_t m_capacity;
+	//позиция следующей записи для чтения, своя у читателя
+	uint64_t m_read;
+
+	Record *At(uint64_t pos) const;
+};
+} //end of shm namespace
+
+#endif /* INCLUDE_LB_SHM_H_ */
@@ -0,0 +1,70 @@
+#ifndef INCLUDE_LB_STORAGE_H_
+#define INCLUDE_LB_STORAGE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <lb_command.h>
+#include <lb_leaderboard.h>
+#include <lb_reminder.h>
+
+/*
+ * Хранение состояния между перезапусками: снимок и журнал примененных команд
+ *
+ * Журнал journal.<N> - двоичные записи команд в порядке применения, только дописывается.
+ * Выигрыши пишутся пачками в том виде, в каком ушли в LeaderBoard::AddWins - проигрыш
+ * повторяет те же пачки, и порядок равных сумм после восстановления тот же.
+ * Снимок snapshot содержит образы LeaderBoard и Reminder на момент начала журнала с номером
+ * из заголовка снимка. Образ - данные как в памяти, загрузка отображает файл и копирует
+ * массивы целиком, разбор по записям нужен только для таблицы пользователей
+ *
+ * Снимок делается потоком применения: образ строится в памяти, журнал переключается на
+ * следующий номер, а запись образа на диск идет в фоновом потоке. После записи снимка
+ * журналы, вошедшие в него, удаляются
+ *
+ * При старте загружается снимок и проигрываются журналы начиная с его номера
+ */
+class Storage {
+public:
+	//проигрыш команд, кроме выигрышей - их пачки Storage применяет сам
+	typedef std::function<void(const cmd::Command &)> Replayer;
+
+	explicit Storage(const std::string &dir);
+	~Storage();
+
+	void Restore(LeaderBoard &board, Reminder &reminder, const Replayer &replay);
+
+	void Append(const cmd::Command &command);
+	void Append(const std::vector<LeaderBoard::Win> &wins);
+	void Flush();
+
+	bool SnapshotDue() const;
+	void Snapshot(LeaderBoard &board, Reminder &reminder);
+private:
+	const std::string m_dir;
+
+	uint64_t m_generation;
+	FILE *m_journal;
+	std::string m_record;
+
+	std::chrono::steady_clock::time_point m_snapshot_time;
+	std::thread m_writer;
+	std::atomic_bool m_writing;
+
+	std::string JournalPath(uint64_t generation) const;
+	std::string SnapshotPath() const;
+
+	uint64_t LoadSnapshot(LeaderBoard &board, Reminder &reminder);
+	bool ReplayJournal(uint64_t generation, LeaderBoard &board, const Replayer &replay);
+	void WriteRecord();
+	void OpenJournal();
+
+	void WriteSnapshot(std::string image, uint64_t generation);
+};
+
+#endif /* INCLUDE_LB_STORAGE_H_ */
@@ -0,0 +1,57 @@
+#ifndef INCLUDE_LB_TRACE_H_
+#define INCLUDE_LB_TRACE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/*
+ * Трассировка горячих путей: TRACE_SCOPE пишет событие с временем начала и длительностью блока
+ * в кольцо своего потока, TRACE_ARG добавляет к нему число (размер пачки, id). Кольца - по TRACE_RING_SIZE
+ * последних событий, запись без блокировок. Dump сохраняет их в формате Chrome trace (chrome://tracing, Perfetto)
+ *
+ * Только при сборке с LB_TRACE (make TRACE=1), иначе макросы пустые и в код не попадают
+ */
+#ifdef LB_TRACE
+#define TRACE_SCOPE(name) trace::Scope trace_scope(name)
+#define TRACE_ARG(value) trace_scope.Arg(static_cast<int64_t>(value))
+#define TRACE_THREAD(name) trace::NameThread(name)
+#else
+#define TRACE_SCOPE(name)
+#define TRACE_ARG(value)
+#define TRACE_THREAD(name)
+#endif
+
+namespace trace {
+//name - строковая константа, событие хранит только указатель
+void Record(const char *name, int64_t begin, int64_t end, int64_t arg);
+void NameThread(const char *name);
+void Dump(const std::string &path);
+
+inline int64_t Now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class Scope {
+public:
+	explicit Scope(const char *name)
+	: m_name(name)
+	, m_begin(Now())
+	, m_arg(0) {}
+
+	~Scope() {
+		Record(m_name, m_begin, Now(), m_arg);
+	}
+
+	void Arg(int64_t value) {
+		m_arg = value;
+	}
+private:
+	const char *m_name;
+	int64_t m_begin;
+	int64_t m_arg;
+};
+} //end of trace namespace
+
+#endif /* INCLUDE_LB_TRACE_H_ */
@@ -0,0 +1,49 @@
+#ifndef INCLUDE_LB_TRANSPORT_H_
+#define INCLUDE_LB_TRANSPORT_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <lb_defines.h>
+
+namespace transport {
+/*
+ * Канал сообщений между сервером и инструментами, не зависящий от способа доставки
+ *
+ * Transport::AMQP - очередь брокера (RABBITMQ_HOST), Transport::SHM - кольцо shm::Ring
+ * в разделяемой памяти для процессов на одной машине: без брокера и без кадров AMQP,
+ * принятое тело не копируется
+ *
+ * Принятое сообщение действительно, пока жив owner (AMQP) или до подтверждения (SHM),
+ * Ack(tag) подтверждает это сообщение и все принятые до него
+ */
+struct Delivery {
+	std::shared_ptr<const void> owner;
+	std::string_view body;
+	uint64_t tag;
+};
+
+class Sender {
+public:
+	virtual ~Sender() {}
+	virtual void Publish(std::string_view body) = 0;
+};
+
+class Receiver {
+public:
+	virtual ~Receiver() {}
+	//timeout_ms < 0 - ждать без ограничения. Возвращает false, если сообщений за это время не было
+	virtual bool Receive(Delivery &delivery, int timeout_ms) = 0;
+	virtual void Ack(uint64_t tag) = 0;
+};
+
+std::unique_ptr<Sender> OpenSender(Transport kind, const std::string &queue);
+std::unique_ptr<Receiver> OpenReceiver(Transport kind, const std::string &queue, int prefetch);
+
+bool Parse(const std::string &name, Transport &kind);
+Transport Select(int &argc, char *argv[]);
+} //end of transport namespace
+
+#endif /* INCLUDE_LB_TRANSPORT_H_ */
@@ -0,0 +1,194 @@
+#include <cstring>
+
+#include <lb_arena.h>
+#include <lb_error.h>
+
+using namespace std;
+
+namespace arena {
+namespace {
+const uint32_t OFFSET_BITS = 20;
+const uint32_t MAX_CHUNKS = 1u << (32 - OFFSET_BITS);
+const uint32_t NO_CHUNK = UINT32_MAX;
+
+//длина имени - varint: имена короткие, обычно хватает одного байта
+uint32_t LengthSize(uint32_t length) {
+	uint32_t size = 1;
+	for (; length >= 0x80; length >>= 7)
+		++size;
+	return size;
+}
+
+char *PutLength(char *dst, uint32_t length) {
+	for (; length >= 0x80; length >>= 7)
+		*dst++ = static_cast<char>((length & 0x7F) | 0x80);
+	*dst++ = static_cast<char>(length);
+	return dst;
+}
+
+const char *GetLength(const char *src, uint32_t &length) {
+	length = 0;
+	for (int shift = 0; ; shift += 7) {
+		uint8_t byte = static_cast<uint8_t>(*src++);
+		length |= static_cast<uint32_t>(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			return src;
+	}
+}
+} //end of anonymous namespace
+
+Names::Names()
+: m_tail(NO_CHUNK)
+, m_garbage(0)
+, m_checked_garbage(0)
+, m_compacting(false) {}
+
+/*
+ * Имя следующего по порядку пользователя
+ */
+void Names::Add(string_view name) {
+	uint32_t slot = static_cast<uint32_t>(m_refs.size());
+	Ref ref = Append(slot, name);
+	m_refs.push_back(ref);
+}
+
+void Names::Set(uint32_t slot, string_view name) {
+	Ref old = m_refs[slot];
+	m_refs[slot] = Append(slot, name);
+
+	uint32_t size = SpanSize(old);
+	m_chunks[old >> OFFSET_BITS].garbage += size;
+	m_garbage += size;
+}
+
+string_view Names::Get(uint32_t slot) const {
+	Ref ref = m_refs[slot];
+	const char *span = m_chunks[ref >> OFFSET_BITS].data.get() + (ref & (CHUNK_SIZE - 1));
+
+	uint32_t length = 0;
+	const char *name = GetLength(span + sizeof(uint32_t), length);
+	return string_view(name, length);
+}
+
+size_t Names::Size() const {
+	return m_refs.size();
+}
+
+size_t Names::MemoryUsage() const {
+	return (m_chunks.size() - m_free_chunks.size()) * CHUNK_SIZE + m_refs.capacity() * sizeof(Ref);
+}
+
+size_t Names::Garbage() const {
+	return m_garbage;
+}
+
+void Names::Reserve(size_t count) {
+	m_refs.reserve(count);
+}
+
+void Names::Clear() {
+	m_refs.clear();
+	m_chunks.clear();
+	m_free_chunks.clear();
+	m_tail = NO_CHUNK;
+	m_garbage = 0;
+	m_checked_garbage = 0;
+	m_compacting = false;
+}
+
+bool Names::CompactDue() const {
+	return m_compacting || m_garbage >= m_checked_garbage + CHUNK_SIZE / 2;
+}
+
+/*
+ * Переносит живые имена из блока, который хотя бы наполовину мусор, и освобождает его
+ * Возвращает false, если такого блока нет
+ */
+bool Names::CompactStep() {
+	uint32_t victim = NO_CHUNK;
+	for (uint32_t chunk = 0; chunk < m_chunks.size(); ++chunk) {
+		const Chunk &desc = m_chunks[chunk];
+		if (chunk == m_tail || !desc.data || desc.garbage * 2 < desc.used)
+			continue;
+		if (victim == NO_CHUNK || desc.garbage > m_chunks[victim].garbage)
+			victim = chunk;
+	}
+	m_compacting = victim != NO_CHUNK;
+	if (victim == NO_CHUNK) {
+		m_checked_garbage = m_garbage;
+		return false;
+	}
+
+	//Append пишет только в хвостовой блок, данные жертвы остаются на месте до освобождения
+	const char *data = m_chunks[victim].data.get();
+	const uint32_t used = m_chunks[victim].used;
+	for (uint32_t offset = 0; offset < used; ) {
+		uint32_t slot = 0;
+		uint32_t length = 0;
+		memcpy(&slot, data + offset, sizeof(slot));
+		const char *name = GetLength(data + offset + sizeof(slot), length);
+
+		Ref ref = (victim << OFFSET_BITS) | offset;
+		if (m_refs[slot] == ref)
+			m_refs[slot] = Append(slot, string_view(name, length));
+
+		offset = static_cast<uint32_t>(name + length - data);
+	}
+
+	Chunk &desc = m_chunks[victim];
+	m_garbage -= desc.garbage;
+	desc.data.reset();
+	desc.used = 0;
+	desc.garbage = 0;
+	m_free_chunks.push_back(victim);
+	return true;
+}
+
+Names::Ref Names::Append(uint32_t slot, string_view name) {
+	const uint32_t length = static_cast<uint32_t>(name.size());
+	const size_t size = sizeof(slot) + LengthSize(length) + name.size();
+	if (size > CHUNK_SIZE)
+		throw err::Error("too long", "username", string(name.substr(0, 32)));
+
+	//остаток прежнего блока остается неиспользованным - он меньше одного имени
+	if (m_tail == NO_CHUNK || m_chunks[m_tail].used + size > CHUNK_SIZE)
+		m_tail = NewChunk();
+
+	Chunk &tail = m_chunks[m_tail];
+	char *dst = tail.data.get() + tail.used;
+	memcpy(dst, &slot, sizeof(slot));
+	dst = PutLength(dst + sizeof(slot), length);
+	memcpy(dst, name.data(), name.size());
+
+	Ref ref = (m_tail << OFFSET_BITS) | tail.used;
+	tail.used += static_cast<uint32_t>(size);
+	return ref;
+}
+
+uint32_t Names::NewChunk() {
+	uint32_t chunk;
+	if (!m_free_chunks.empty()) {
+		chunk = m_free_chunks.back();
+		m_free_chunks.pop_back();
+	} else {
+		if (m_chunks.size() >= MAX_CHUNKS)
+			throw err::Error("overflow", "usernames");
+		chunk = static_cast<uint32_t>(m_chunks.size());
+		m_chunks.emplace_back();
+	}
+
+	Chunk &desc = m_chunks[chunk];
+	desc.data.reset(new char[CHUNK_SIZE]);
+	desc.used = 0;
+	desc.garbage = 0;
+	return chunk;
+}
+
+uint32_t Names::SpanSize(Ref ref) const {
+	const char *span = m_chunks[ref >> OFFSET_BITS].data.get() + (ref & (CHUNK_SIZE - 1));
+
+	uint32_t length = 0;
+	const char *name = GetLength(span + sizeof(uint32_t), length);
+	return static_cast<uint32_t>(name + length - span);
+}
+} //end of arena namespace
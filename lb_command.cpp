@@ -0,0 +1,53 @@
+#include <cmath>
+
+#include <lb_command.h>
+#include <lb_defines.h>
+#include <lb_error.h>
+
+using namespace std;
+
+namespace cmd {
+/*
+ * Разбирает и валидирует сообщение без копирования полей
+ * При ошибке бросает err::Error
+ */
+void Parse(string_view msg, Command &command) {
+	string_view msg_type = str::NextWord(msg, '\n');
+	string_view id_str = str::NextWord(msg, '\n');
+
+	//валидировать id в реальности надо после валидации типа сообщения
+	if (!test::Numeric(id_str) || !str::ToInt64(id_str, command.id))
+		throw err::Error("invalid", "id", string(id_str));
+
+	if (msg_type == MSG_USER_REGISTER || msg_type == MSG_USER_RENAME) {
+		command.type = msg_type == MSG_USER_REGISTER ? USER_REGISTER : USER_RENAME;
+		command.name = str::NextWord(msg, '\n');
+		if (!test::Username(command.name))
+			throw err::Error("invalid", "username", string(command.name));
+	} else if (msg_type == MSG_USER_WON) {
+		command.type = USER_WON;
+		string_view date_str = str::NextWord(msg, '\n');
+		string_view amount_str = str::NextWord(msg, '\n'); //целиком число, конечное и больше нуля
+		if (!str::ToDouble(amount_str, command.amount) || !isfinite(command.amount) || command.amount <= 0)
+			throw err::Error("invalid", "amount", string(amount_str));
+
+		command.date = date::FromString(date_str);
+	} else if (msg_type == MSG_USER_CONNECT) {
+		command.type = USER_CONNECT;
+	} else if (msg_type == MSG_USER_DISCONNECT) {
+		command.type = USER_DISCONNECT;
+	} else
+		throw err::Error("invalid", "msg_type", string(msg_type));
+
+	command.token = 0;
+	string_view token_str = str::NextWord(msg, '\n');
+	if (token_str.compare(0, MSG_TOKEN.size(), MSG_TOKEN) != 0)
+		return;
+
+	int64_t token = 0;
+	token_str.remove_prefix(MSG_TOKEN.size());
+	if (!test::Numeric(token_str) || !str::ToInt64(token_str, token) || token <= 0)
+		throw err::Error("invalid", "token", string(token_str));
+	command.token = static_cast<uint64_t>(token);
+}
+} //end of cmd namespace
@@ -1,10 +1,18 @@
+#include <charconv>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <iostream>
 
 #include <lb_functions.h>
 #include <lb_error.h>
 
 using namespace std;
 
+void Debug(const string &msg) {
+	cout << msg << endl;
+}
+
 namespace str {
 string GetWord(string &src, char delimiter) {
 	string res;
@@ -19,14 +27,69 @@ string GetWord(string &src, char delimiter) {
 	return res;
 }
 
+/*
+ * Отрезает от src слово до разделителя без копирования
+ */
+string_view NextWord(string_view &src, char delimiter) {
+	string_view res;
+	string_view::size_type pos = src.find(delimiter);
+	if (pos==string_view::npos) {
+		res = src;
+		src = string_view();
+	} else {
+		res = src.substr(0, pos);
+		src.remove_prefix(pos + 1);
+	}
+	return res;
+}
+
 int64_t Int64(const string &val) {
 	return strtoq(val.c_str(), 0, 10);
 }
 
+/*
+ * Все слово должно быть числом, переполнение - ошибка
+ */
+bool ToInt64(string_view val, int64_t &res) {
+	auto parsed = from_chars(val.data(), val.data() + val.size(), res);
+	return parsed.ec == errc() && parsed.ptr == val.data() + val.size();
+}
+
+/*
+ * Как и ToInt64, слово должно быть числом целиком. nan и inf from_chars тоже принимает - их отсекает вызывающий
+ */
+bool ToDouble(string_view val, double &res) {
+	res = 0;
+	auto parsed = from_chars(val.data(), val.data() + val.size(), res);
+	return parsed.ec == errc() && parsed.ptr == val.data() + val.size();
+}
+
 string Str(int64_t val) {
+	string res;
+	Append(res, val);
+	return res;
+}
+
+/*
+ * Дописывают число в конец dst без временных строк. to_chars дает те же байты, что и printf
+ */
+void Append(string &dst, int64_t val) {
+	char buf[24];
+	auto res = to_chars(buf, buf + sizeof(buf), val);
+	dst.append(buf, res.ptr - buf);
+}
+
+void Append(string &dst, double val, int precision) {
 	char buf[32];
-	snprintf(buf, sizeof(buf), "%lld", (long long)val);
-	return buf;
+	auto res = to_chars(buf, buf + sizeof(buf) - 1, val, chars_format::fixed, precision);
+	if (res.ec == errc()) {
+		dst.append(buf, res.ptr - buf);
+		return;
+	}
+
+	//огромные значения snprintf обрезал по размеру буфера - сохраняем тот же вывод
+	snprintf(buf, sizeof(buf), "%.*f", precision, val);
+	dst += buf;
 }
 
 double Double(const string &val) {
@@ -34,9 +97,9 @@ double Double(const string &val) {
 }
 
 string Str(double val, int precision) {
-	char buf[32];
-	snprintf(buf, sizeof(buf), "%.*f", precision, val);
-	return buf;
+	string res;
+	Append(res, val, precision);
+	return res;
 }
 } //end of str namespace
 
@@ -49,7 +112,7 @@ inline bool islatin(const unsigned char ch) {
 	return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
 }
 
-bool Numeric(const string &data) {
+bool Numeric(string_view data) {
 	if (data.empty())
 		return false;
 
@@ -60,7 +123,7 @@ bool Numeric(const string &data) {
 	return true;
 }
 
-bool Username(const string &data) {
+bool Username(string_view data) {
 	if (data.empty())
 		return false;
 
@@ -84,25 +147,171 @@ string Format(const SystemTimePoint &time, const string &format) {
 	return string(buf, size);
 }
 
-SystemTimePoint FromString(const string &date) {
+/*
+ * Разбор через strptime и mktime - для любых дат, которые не обрабатывает быстрый путь
+ */
+time_t FromStringMktime(string_view date) {
+	//strptime нужна строка с завершающим нулем, длиннее формата даты быть не может
+	char buf[64];
+	if (date.size() >= sizeof(buf))
+		throw err::Error("invalid", "date", string(date));
+	memcpy(buf, date.data(), date.size());
+	buf[date.size()] = 0;
+
 	struct tm tm;
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_isdst = -1;
 
-	if (strptime(date.c_str(), "%Y-%m-%d %H:%M:%S", &tm) == nullptr)
+	if (strptime(buf, "%Y-%m-%d %H:%M:%S", &tm) == nullptr)
 		throw err::Error("syscall", "mktime");
 
 	time_t dated = mktime(&tm);
 	if (dated == -1)
 		throw err::Error("syscall", "mktime");
 
-	return chrono::system_clock::from_time_t(dated);
+	return dated;
+}
+
+/*
+ * Количество дней от 1970-01-01 по григорианскому календарю
+ * День больше длины месяца переносится на следующий месяц, как в mktime
+ */
+int64_t DaysFromCivil(int64_t year, int64_t month, int64_t day) {
+	year -= month <= 2;
+	const int64_t era = (year >= 0 ? year : year - 399) / 400;
+	const int64_t year_of_era = year - era * 400;
+	const int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	const int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+	return era * 146097 + day_of_era - 719468;
+}
+
+inline bool ParseDigits(string_view date, size_t pos, size_t count, int64_t min, int64_t max, int64_t &res) {
+	res = 0;
+	for (size_t cnt = pos; cnt < pos + count; ++cnt) {
+		unsigned char ch = date[cnt];
+		if (ch < '0' || ch > '9')
+			return false;
+		res = res * 10 + (ch - '0');
+	}
+	return res >= min && res <= max;
+}
+
+/*
+ * Строгий YYYY-MM-DD hh:mm:ss в локальные секунды (время, как если бы оно было UTC)
+ * Пределы полей - как у strptime
+ */
+bool ParseLocalSeconds(string_view date, int64_t &local) {
+	if (date.size() != 19 || date[4] != '-' || date[7] != '-' || date[10] != ' ' || date[13] != ':' || date[16] != ':')
+		return false;
+
+	int64_t year, month, day, hour, minute, second;
+	if (!ParseDigits(date, 0, 4, 0, 9999, year) ||
+			!ParseDigits(date, 5, 2, 1, 12, month) ||
+			!ParseDigits(date, 8, 2, 1, 31, day) ||
+			!ParseDigits(date, 11, 2, 0, 23, hour) ||
+			!ParseDigits(date, 14, 2, 0, 59, minute) ||
+			!ParseDigits(date, 17, 2, 0, 61, second))
+		return false;
+
+	local = DaysFromCivil(year, month, day) * 24 * 60 * 60 + hour * 60 * 60 + minute * 60 + second;
+	return true;
+}
+
+/*
+ * Смещение локального времени на текущую неделю
+ * Если внутри недели есть переход на летнее/зимнее время, смещений два - до и после него.
+ * Локальное время вокруг перехода (несуществующее или неоднозначное) в кэш не попадает
+ * и разбирается через mktime
+ */
+struct LocalOffsetCache {
+	time_t week_end;
+	int64_t local_begin;
+	int64_t local_split_lo;
+	int64_t local_split_hi;
+	int64_t local_end;
+	long offset_before;
+	long offset_after;
+};
+
+thread_local LocalOffsetCache offset_cache = {0, 0, 0, 0, -1, 0, 0};
+
+long LocalOffset(time_t utc) {
+	struct tm dateinfo;
+	if (localtime_r(&utc, &dateinfo) == nullptr)
+		throw err::Error("syscall", "localtime_r");
+	return dateinfo.tm_gmtoff;
+}
+
+void BuildOffsetCache(LocalOffsetCache &cache) {
+	time_t begin = chrono::system_clock::to_time_t(GetWeekBegin());
+	time_t end = chrono::system_clock::to_time_t(GetWeekEnd());
+	long offset_begin = LocalOffset(begin);
+	long offset_end = LocalOffset(end);
+
+	//первая секунда с новым смещением, переход за неделю считаем единственным
+	time_t transition = end + 1;
+	if (offset_begin != offset_end) {
+		time_t lo = begin;
+		time_t hi = end;
+		while (hi - lo > 1) {
+			time_t mid = lo + (hi - lo) / 2;
+			if (LocalOffset(mid) == offset_begin)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		transition = hi;
+	}
+
+	cache.week_end = end;
+	cache.offset_before = offset_begin;
+	cache.offset_after = offset_end;
+	cache.local_begin = begin + offset_begin;
+	cache.local_end = end + offset_end;
+	cache.local_split_lo = transition + min(offset_begin, offset_end);
+	cache.local_split_hi = transition + max(offset_begin, offset_end);
+}
+
+inline bool OffsetCached(const LocalOffsetCache &cache, int64_t local, time_t &dated) {
+	if (local >= cache.local_begin && local < cache.local_split_lo) {
+		dated = local - cache.offset_before;
+		return true;
+	}
+	if (local >= cache.local_split_hi && local <= cache.local_end) {
+		dated = local - cache.offset_after;
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Даты текущей недели переводятся арифметикой по закэшированному смещению,
+ * без mktime и его блокировки часового пояса. Результат совпадает с mktime (tm_isdst = -1)
+ */
+SystemTimePoint FromString(string_view date) {
+	int64_t local;
+	time_t dated;
+	if (ParseLocalSeconds(date, local)) {
+		LocalOffsetCache &cache = offset_cache;
+		if (OffsetCached(cache, local, dated))
+			return chrono::system_clock::from_time_t(dated);
+
+		if (time(nullptr) > cache.week_end) {
+			BuildOffsetCache(cache);
+			if (OffsetCached(cache, local, dated))
+				return chrono::system_clock::from_time_t(dated);
+		}
+	}
+
+	return chrono::system_clock::from_time_t(FromStringMktime(date));
 }
 
 time_t WeekBeginDiff(const struct tm &dateinfo) {
-	//Diff all secs, mins, hours, days of week (remember Sunday as week begin)
+	//Diff all secs, mins, hours, days of week (remember Monday as week begin, tm_wday counts from Sunday)
 	return dateinfo.tm_sec +
 			dateinfo.tm_min * 60 +
 			dateinfo.tm_hour * 60 * 60 +
-			(dateinfo.tm_wday - 1) * 24 * 60 * 60;
+			((dateinfo.tm_wday + 6) % 7) * 24 * 60 * 60;
 }
 
 SystemTimePoint GetWeekBegin() {
@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <cmath>
+
+#include <lb_histogram.h>
+
+using namespace std;
+
+namespace hist {
+namespace {
+const uint64_t SUB_COUNT = 1ull << Histogram::SUB_BITS;
+//корзины точных значений и по SUB_COUNT на каждую степень двойки от 2^SUB_BITS до 2^63
+const size_t BUCKETS = (64 - Histogram::SUB_BITS + 1) * SUB_COUNT;
+} //end of anonymous namespace
+
+Histogram::Histogram()
+: m_counts(BUCKETS, 0)
+, m_count(0)
+, m_sum(0)
+, m_max(0) {}
+
+void Histogram::Add(uint64_t value, uint64_t count) {
+	m_counts[Bucket(value)] += count;
+	m_count += count;
+	m_sum += value * count;
+	m_max = max(m_max, value);
+}
+
+void Histogram::Merge(const Histogram &other) {
+	for (size_t bucket = 0; bucket < BUCKETS; ++bucket)
+		m_counts[bucket] += other.m_counts[bucket];
+	m_count += other.m_count;
+	m_sum += other.m_sum;
+	m_max = max(m_max, other.m_max);
+}
+
+void Histogram::Clear() {
+	fill(m_counts.begin(), m_counts.end(), 0);
+	m_count = 0;
+	m_sum = 0;
+	m_max = 0;
+}
+
+uint64_t Histogram::Count() const {
+	return m_count;
+}
+
+uint64_t Histogram::Max() const {
+	return m_max;
+}
+
+double Histogram::Mean() const {
+	return m_count ? double(m_sum) / m_count : 0;
+}
+
+/*
+ * share от 0 до 1. Для пустой гистограммы - 0
+ */
+uint64_t Histogram::Percentile(double share) const {
+	if (m_count == 0)
+		return 0;
+
+	uint64_t target = max<uint64_t>(1, static_cast<uint64_t>(ceil(share * m_count)));
+	uint64_t seen = 0;
+	for (size_t bucket = 0; bucket < BUCKETS; ++bucket) {
+		seen += m_counts[bucket];
+		if (seen >= target)
+			return min(Highest(bucket), m_max);
+	}
+	return m_max;
+}
+
+size_t Histogram::Buckets() {
+	return BUCKETS;
+}
+
+size_t Histogram::Bucket(uint64_t value) {
+	if (value < SUB_COUNT)
+		return static_cast<size_t>(value);
+
+	const int top = 63 - __builtin_clzll(value);
+	const int shift = top - SUB_BITS;
+	return static_cast<size_t>((shift + 1) * SUB_COUNT + ((value >> shift) & (SUB_COUNT - 1)));
+}
+
+uint64_t Histogram::Highest(size_t bucket) {
+	if (bucket < SUB_COUNT)
+		return bucket;
+
+	const int shift = static_cast<int>(bucket / SUB_COUNT) - 1;
+	const uint64_t low = (SUB_COUNT + bucket % SUB_COUNT) << shift;
+	return low + ((1ull << shift) - 1);
+}
+} //end of hist namespace
@@ -0,0 +1,146 @@
+#include <lb_index.h>
+
+using namespace std;
+
+namespace flat {
+namespace {
+const size_t MIN_CAPACITY = 16;
+
+//заполнение не выше 3/4 - дальше цепочки пробирования резко растут
+bool Overloaded(size_t size, size_t capacity) {
+	return size * 4 > capacity * 3;
+}
+} //end of anonymous namespace
+
+Index::Index()
+: m_size(0)
+, m_shift(32) {
+	Rehash(MIN_CAPACITY);
+}
+
+uint32_t Index::Find(int64_t id) const {
+	const uint32_t hash = Hash(id);
+	const size_t mask = m_buckets.size() - 1;
+	for (size_t pos = Home(hash); ; pos = (pos + 1) & mask) {
+		const Bucket &bucket = m_buckets[pos];
+		if (bucket.slot == NONE)
+			return NONE;
+		if (bucket.hash == hash && m_ids[bucket.slot] == id)
+			return bucket.slot;
+	}
+}
+
+/*
+ * Возвращает false, если id уже есть
+ */
+bool Index::Insert(int64_t id, uint32_t slot) {
+	if (Overloaded(m_size + 1, m_buckets.size()))
+		Rehash(m_buckets.size() * 2);
+
+	const uint32_t hash = Hash(id);
+	const size_t mask = m_buckets.size() - 1;
+	for (size_t pos = Home(hash); ; pos = (pos + 1) & mask) {
+		Bucket &bucket = m_buckets[pos];
+		if (bucket.slot == NONE) {
+			bucket.slot = slot;
+			bucket.hash = hash;
+			if (m_ids.size() <= slot)
+				m_ids.resize(slot + 1);
+			m_ids[slot] = id;
+			++m_size;
+			return true;
+		}
+		if (bucket.hash == hash && m_ids[bucket.slot] == id)
+			return false;
+	}
+}
+
+/*
+ * Возвращает слот удаленного id или NONE. Слот может быть переиспользован вызывающим
+ */
+uint32_t Index::Erase(int64_t id) {
+	const uint32_t hash = Hash(id);
+	const size_t mask = m_buckets.size() - 1;
+	size_t pos = Home(hash);
+	for ( ; ; pos = (pos + 1) & mask) {
+		const Bucket &bucket = m_buckets[pos];
+		if (bucket.slot == NONE)
+			return NONE;
+		if (bucket.hash == hash && m_ids[bucket.slot] == id)
+			break;
+	}
+
+	uint32_t slot = m_buckets[pos].slot;
+	--m_size;
+
+	//сдвигаем назад следующие элементы цепочки, которые могут занять освободившееся место
+	size_t hole = pos;
+	for (size_t next = (hole + 1) & mask; m_buckets[next].slot != NONE; next = (next + 1) & mask) {
+		size_t home = Home(m_buckets[next].hash);
+		if (((next - home) & mask) >= ((next - hole) & mask)) {
+			m_buckets[hole] = m_buckets[next];
+			hole = next;
+		}
+	}
+	m_buckets[hole].slot = NONE;
+
+	return slot;
+}
+
+int64_t Index::Id(uint32_t slot) const {
+	return m_ids[slot];
+}
+
+size_t Index::Size() const {
+	return m_size;
+}
+
+size_t Index::MemoryUsage() const {
+	return m_buckets.capacity() * sizeof(Bucket) + m_ids.capacity() * sizeof(int64_t);
+}
+
+void Index::Reserve(size_t count) {
+	m_ids.reserve(count);
+
+	size_t capacity = m_buckets.size();
+	while (Overloaded(count, capacity))
+		capacity *= 2;
+	if (capacity != m_buckets.size())
+		Rehash(capacity);
+}
+
+void Index::Clear() {
+	m_buckets.clear();
+	m_ids.clear();
+	m_size = 0;
+	Rehash(MIN_CAPACITY);
+}
+
+uint32_t Index::Hash(int64_t id) {
+	return static_cast<uint32_t>((static_cast<uint64_t>(id) * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+size_t Index::Home(uint32_t hash) const {
+	return hash >> m_shift;
+}
+
+void Index::Rehash(size_t capacity) {
+	vector<Bucket> buckets(capacity, Bucket{NONE, 0});
+	buckets.swap(m_buckets);
+
+	m_shift = 32;
+	for (size_t size = capacity; size > 1; size >>= 1)
+		--m_shift;
+
+	const size_t mask = capacity - 1;
+	for (auto &bucket : buckets) {
+		if (bucket.slot == NONE)
+			continue;
+
+		size_t pos = Home(bucket.hash);
+		while (m_buckets[pos].slot != NONE)
+			pos = (pos + 1) & mask;
+		m_buckets[pos] = bucket;
+	}
+}
+} //end of flat namespace
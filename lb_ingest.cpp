@@ -0,0 +1,311 @@
+#include <lb_defines.h>
+#include <lb_error.h>
+#include <lb_ingest.h>
+#include <lb_metrics.h>
+#include <lb_trace.h>
+
+using namespace std;
+
+namespace {
+//метрика времени применения по типу команды (cmd::Type)
+const metrics::Metric APPLY_METRICS[] = {
+	metrics::APPLY_REGISTER,
+	metrics::APPLY_RENAME,
+	metrics::APPLY_WON,
+	metrics::APPLY_CONNECT,
+	metrics::APPLY_DISCONNECT
+};
+} //end of anonymous namespace
+
+Ingest::Ingest(LeaderBoard &board, Reminder &reminder, Storage *storage, int decoders)
+: m_board(board)
+, m_reminder(reminder)
+, m_storage(storage)
+, m_stopped(false)
+, m_failed(false)
+, m_pushed(0)
+, m_applied(0)
+, m_reported(chrono::steady_clock::now()) {
+	for (int worker = 0; worker < decoders; ++worker) {
+		m_raw.emplace_back(new ring::Spsc<Raw>(INGEST_RING_SIZE));
+		m_decoded.emplace_back(new ring::Spsc<Record>(INGEST_RING_SIZE));
+		m_decode_counters.emplace_back(new Counters());
+	}
+}
+
+Ingest::~Ingest() {
+	if (!m_stopped)
+		Stop();
+}
+
+/*
+ * Загружает снимок и проигрывает журнал. Вызывается до Start
+ */
+void Ingest::Restore() {
+	if (!m_storage)
+		return;
+
+	m_storage->Restore(m_board, m_reminder, [this](const cmd::Command &command) {
+		Process(command);
+	});
+	FlushWins();
+}
+
+void Ingest::Start() {
+	for (size_t worker = 0; worker < m_raw.size(); ++worker)
+		m_threads.emplace_back(&Ingest::Decode, this, worker);
+	m_threads.emplace_back(&Ingest::Apply, this);
+}
+
+void Ingest::Stop() {
+	m_stopped = true;
+	for (auto &worker : m_threads)
+		worker.join();
+	m_threads.clear();
+}
+
+/*
+ * Вызывается из потока приема. Возвращает порядковый номер сообщения,
+ * сообщение применено, когда Applied() стал больше этого номера
+ */
+uint64_t Ingest::Push(Raw &&raw) {
+	auto &target = *m_raw[m_pushed % m_raw.size()];
+
+	ring::Backoff backoff;
+	while (!target.Push(move(raw))) {
+		++m_push_counters.stalls;
+		backoff.Wait();
+	}
+
+	++m_push_counters.processed;
+	return m_pushed++;
+}
+
+uint64_t Ingest::Applied() const {
+	return m_applied.load(memory_order_acquire);
+}
+
+/*
+ * Пропускная способность стадий и число простоев из-за заполненного следующего кольца
+ * (для приема и разбора) или пустого предыдущего (для применения) с прошлого вызова
+ */
+void Ingest::Report() {
+	auto now = chrono::steady_clock::now();
+	double secs = chrono::duration<double>(now - m_reported).count();
+	m_reported = now;
+	if (secs <= 0)
+		return;
+
+	auto rate = [secs](Counters &counters) {
+		uint64_t processed = counters.processed;
+		string res = str::Str(double(processed - counters.reported) / secs, 0) + "/s";
+		counters.reported = processed;
+		return res + " (stalls " + str::Str((int64_t)counters.stalls.exchange(0)) + ")";
+	};
+
+	string decoded;
+	for (auto &counters : m_decode_counters)
+		decoded += " " + rate(*counters);
+
+	Debug("Ingest: received " + rate(m_push_counters) +
+			", decoded" + decoded +
+			", applied " + rate(m_apply_counters));
+}
+
+void Ingest::Decode(size_t worker) {
+	TRACE_THREAD("decode");
+	auto &input = *m_raw[worker];
+	auto &output = *m_decoded[worker];
+	auto &counters = *m_decode_counters[worker];
+
+	ring::Backoff backoff;
+	Record record;
+	while (!m_stopped) {
+		if (!input.Pop(record.raw)) {
+			backoff.Wait();
+			continue;
+		}
+		backoff.Reset();
+
+		try {
+			TRACE_SCOPE("cmd::Parse");
+			cmd::Parse(record.raw.body, record.command);
+			record.valid = true;
+		} catch(const err::Error& e) {
+			Debug("Failed to process request: " + string(e.what()));
+			record.valid = false;
+		}
+
+		while (!output.Push(move(record))) {
+			if (m_stopped)
+				return;
+			++counters.stalls;
+			backoff.Wait();
+		}
+		backoff.Reset();
+		++counters.processed;
+	}
+}
+
+/*
+ * Единственный поток, меняющий таблицу. Выигрыши копятся и применяются одним AddWins
+ * перед любой другой командой, по INPUT_BATCH_SIZE и когда сообщения кончились.
+ * После ошибки журнала поток останавливается (см. Fail)
+ */
+void Ingest::Apply() {
+	TRACE_THREAD("apply");
+	ring::Backoff backoff;
+	Record record;
+	uint64_t next = 0;
+	uint64_t published = 0;
+	while (!m_stopped && !m_failed) {
+		if (!m_decoded[next % m_decoded.size()]->Pop(record)) {
+			if (published != next) {
+				Publish(next);
+				published = next;
+			} else if (m_board.CompactNames()) {
+				//уплотнение имен - только в простое, по одному блоку за раз
+				continue;
+			}
+			++m_apply_counters.stalls;
+			backoff.Wait();
+			continue;
+		}
+		backoff.Reset();
+
+		//выигрыши пишутся в журнал пачкой при применении
+		if (record.valid && Process(record.command) && m_storage && record.command.type != cmd::USER_WON) {
+			try {
+				m_storage->Append(record.command);
+			} catch(const err::Error& e) {
+				Fail(e);
+			}
+		}
+		record.raw = Raw();
+
+		++next;
+		++m_apply_counters.processed;
+		if (next - published >= static_cast<uint64_t>(INPUT_BATCH_SIZE)) {
+			Publish(next);
+			published = next;
+		}
+	}
+
+	Publish(next);
+}
+
+/*
+ * Применяет накопленное, сбрасывает журнал и только потом отдает applied на подтверждение.
+ * Если журнал не записан, applied не двигается - неподтвержденное брокер отдаст заново после перезапуска
+ */
+void Ingest::Publish(uint64_t applied) {
+	FlushWins();
+
+	if (m_storage && !m_failed) {
+		try {
+			m_storage->Flush();
+			if (m_storage->SnapshotDue())
+				m_storage->Snapshot(m_board, m_reminder);
+		} catch(const err::Error& e) {
+			Fail(e);
+		}
+	}
+
+	if (!m_failed)
+		m_applied.store(applied, memory_order_release);
+}
+
+/*
+ * Что попало в журнал после ошибки, уже не совпадает с подтвержденным, поэтому ни записи,
+ * ни подтверждений больше нет: очереди заполняются, прием встает до перезапуска
+ */
+void Ingest::Fail(const err::Error &e) {
+	Debug("Failed to store state, ingest stopped until restart: " + string(e.what()));
+	m_failed = true;
+}
+
+/*
+ * Возвращает false, если команда отвергнута. Выигрыши проверяются при применении пачки
+ */
+bool Ingest::Process(const cmd::Command &command) {
+	if (command.type == cmd::USER_WON) {
+		m_wins.push_back({command.id, command.date, command.amount});
+		if (command.token)
+			m_tokens.emplace_back(command.id, command.token);
+		if (m_wins.size() >= static_cast<size_t>(INPUT_BATCH_SIZE))
+			FlushWins();
+		return true;
+	}
+
+	FlushWins();
+
+	TRACE_SCOPE("Ingest::ApplyCommand");
+	TRACE_ARG(command.type);
+	const bool timed = metrics::Sample();
+	const auto begin = timed ? chrono::steady_clock::now() : date::SteadyTimePoint();
+	bool applied = ApplyCommand(command);
+	if (timed)
+		metrics::Add(APPLY_METRICS[command.type], metrics::Nanoseconds(begin));
+	return applied;
+}
+
+bool Ingest::ApplyCommand(const cmd::Command &command) {
+	try {
+		switch (command.type) {
+		case cmd::USER_REGISTER:
+			m_board.AddUser(command.id, command.name);
+			break;
+		case cmd::USER_RENAME:
+			m_board.RenameUser(command.id, command.name);
+			break;
+		case cmd::USER_CONNECT:
+			m_board.AssertUser(command.id);
+			m_reminder.ConnectUser(command.id, command.token);
+			break;
+		case cmd::USER_DISCONNECT:
+			m_board.AssertUser(command.id);
+			m_reminder.DisconnectUser(command.id);
+			break;
+		case cmd::USER_WON:
+			break;
+		}
+	} catch(const err::Error& e) {
+		//Обработка сообщений об ошибках
+		Debug("Failed to process request: " + string(e.what()));
+		return false;
+	}
+	return true;
+}
+
+void Ingest::FlushWins() {
+	if (m_wins.empty())
+		return;
+
+	if (m_storage) {
+		try {
+			if (!m_failed)
+				m_storage->Append(m_wins);
+		} catch(const err::Error& e) {
+			Fail(e);
+		}
+		//не записанное в журнал не применяется
+		if (m_failed) {
+			m_wins.clear();
+			m_tokens.clear();
+			return;
+		}
+	}
+
+	//пачка - одна из METRICS_SAMPLE - замеряется целиком, каждому выигрышу - его доля
+	const bool timed = metrics::Sample();
+	const auto begin = timed ? chrono::steady_clock::now() : date::SteadyTimePoint();
+	m_board.AddWins(m_wins);
+	if (timed)
+		metrics::Add(metrics::APPLY_WON, metrics::Nanoseconds(begin) / m_wins.size(), m_wins.size());
+	m_wins.clear();
+
+	//метки замера - после применения, чтобы ушли с сообщением, уже учитывающим выигрыш
+	for (const auto &token : m_tokens)
+		m_reminder.Tag(token.first, token.second);
+	m_tokens.clear();
+}
@@ -0,0 +1,589 @@
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+#include <lb_defines.h>
+#include <lb_error.h>
+#include <lb_leaderboard.h>
+#include <lb_trace.h>
+
+using namespace std;
+
+LeaderBoard::LeaderBoard()
+: m_week_begin(date::GetWeekBegin())
+, m_week_end(date::GetWeekEnd())
+, m_leaders_version(1)
+, m_leaders_block_version(0) {
+	PublishLeaders();
+}
+
+bool LeaderBoard::HasUser(const int64_t id) const {
+	shared_lock<shared_mutex> cs(m_mutex);
+
+	return m_users.Find(id) != flat::Index::NONE;
+}
+
+void LeaderBoard::AssertUser(const int64_t id) const {
+	if (!HasUser(id))
+		throw err::Error("missed", "user_id", str::Str(id));
+}
+
+/*
+ * Строки сообщения пишутся прямо в выходной буфер. Переиспользуемый буфер
+ * после первых вызовов уже не перевыделяется
+ */
+string LeaderBoard::GetStatMessage(const int64_t id) {
+	thread_local string buffer;
+	GetStatMessage(id, buffer);
+	return buffer;
+}
+
+void LeaderBoard::GetStatMessage(const int64_t id, string &result) {
+	TRACE_SCOPE("LeaderBoard::GetStatMessage");
+	TRACE_ARG(id);
+	result.clear();
+	shared_lock<shared_mutex> cs(m_mutex);
+	CheckWeeklyDrop(cs);
+
+	RenderStat(FindUser(id), result);
+}
+
+/*
+ * Строит сообщение, только если отпечаток отличается от переданного, и обновляет его
+ * Возвращает false, если с прошлой отправки ничего не изменилось. Нулевой отпечаток не совпадает ни с чем
+ */
+bool LeaderBoard::GetStatMessage(const int64_t id, string &result, uint64_t &fingerprint) {
+	TRACE_SCOPE("LeaderBoard::GetStatMessage");
+	TRACE_ARG(id);
+	result.clear();
+	shared_lock<shared_mutex> cs(m_mutex);
+	CheckWeeklyDrop(cs);
+
+	auto user_pos = FindUser(id);
+	uint64_t current = Fingerprint(user_pos);
+	if (current == fingerprint)
+		return false;
+
+	fingerprint = current;
+	RenderStat(user_pos, result);
+	return true;
+}
+
+namespace {
+//хеш строки на месте place в View, 0 - места в нем нет
+uint64_t HashAt(const LeaderBoard::View &view, int64_t place) {
+	if (place >= 1 && place <= MAX_NEIGHBOURS && view.leaders[place - 1] != 0)
+		return view.leaders[place - 1];
+
+	int64_t offset = place - view.place + MAX_NEIGHBOURS;
+	if (offset >= 0 && offset <= 2 * MAX_NEIGHBOURS)
+		return view.window[offset];
+	return 0;
+}
+} //end of anonymous namespace
+
+/*
+ * Изменения с прошлой отправки. view - то, что было отправлено, обновляется до текущего
+ * Возвращает false, если не изменилось ничего - тогда в result только заголовок
+ */
+bool LeaderBoard::GetStatDelta(const int64_t id, string &result, View &view) {
+	TRACE_SCOPE("LeaderBoard::GetStatDelta");
+	TRACE_ARG(id);
+	result.clear();
+	shared_lock<shared_mutex> cs(m_mutex);
+	CheckWeeklyDrop(cs);
+
+	auto user_pos = FindUser(id);
+	View current;
+	rating::Handle leaders[MAX_NEIGHBOURS];
+	rating::Handle window[2 * MAX_NEIGHBOURS + 1];
+	FillView(user_pos, current, leaders, window);
+
+	if (view.week != current.week) {
+		view = current;
+		RenderStat(user_pos, result);
+		return true;
+	}
+
+	//места, которые видны сейчас или были видны раньше, по возрастанию
+	int64_t places[3 * MAX_NEIGHBOURS + 2 * (2 * MAX_NEIGHBOURS + 1)];
+	size_t count = 0;
+	for (int64_t place = 1; place <= MAX_NEIGHBOURS; ++place)
+		places[count++] = place;
+	for (int64_t offset = -MAX_NEIGHBOURS; offset <= MAX_NEIGHBOURS; ++offset) {
+		places[count++] = current.place + offset;
+		places[count++] = view.place + offset;
+	}
+	sort(places, places + count);
+	count = unique(places, places + count) - places;
+
+	result += "Delta:\nUser: ";
+	str::Append(result, current.place);
+	const size_t header_size = result.size();
+
+	for (size_t pos = 0; pos < count; ++pos) {
+		int64_t place = places[pos];
+		uint64_t hash = HashAt(current, place);
+		if (hash == HashAt(view, place))
+			continue;
+
+		if (hash == 0) {
+			result += '\n';
+			str::Append(result, place);
+			result += ". -";
+			continue;
+		}
+
+		int64_t offset = place - current.place + MAX_NEIGHBOURS;
+		bool in_window = offset >= 0 && offset <= 2 * MAX_NEIGHBOURS && current.window[offset] != 0;
+		AppendLine(result, in_window ? window[offset] : leaders[place - 1], place);
+	}
+
+	bool changed = result.size() != header_size || current.place != view.place;
+	view = current;
+	return changed;
+}
+
+/*
+ * Вызывается под shared-блокировкой
+ */
+void LeaderBoard::RenderStat(rating::Handle user_pos, string &result) const {
+	//первые 10 позиций рейтинга, позицию юзера в рейтинге, +- 10 соседей по рейтингу для текущего пользователя
+	if (m_board.Size() == 0)
+		throw err::Error("missed", "leaderboard");
+
+	int64_t user_place = m_board.Place(user_pos);
+
+	//Формат не ограничен, поэтому выведу в человекочитаемом виде
+	result += "User:";
+	AppendLine(result, user_pos, user_place);
+
+	//устаревший блок бывает только после записи, прерванной ошибкой, - тогда строится на месте
+	if (m_leaders_block_version == m_leaders_version)
+		result += m_leaders_block;
+	else
+		AppendLeaders(result);
+
+	result += "\nNeighbours up:";
+	//соседи сверху собираются от ближнего к дальнему, а выводятся в обратном порядке
+	rating::Handle up[MAX_NEIGHBOURS];
+	int up_count = 0;
+	for (auto cur = m_board.Better(user_pos); cur != rating::NIL && up_count < MAX_NEIGHBOURS; cur = m_board.Better(cur))
+		up[up_count++] = cur;
+
+	if (up_count == 0)
+		result += " empty";
+	for (int pos = up_count - 1; pos >= 0; --pos)
+		AppendLine(result, up[pos], user_place - 1 - pos);
+
+	result += "\nNeighbours down:";
+	auto cur_board_down = m_board.Worse(user_pos);
+	if (cur_board_down == rating::NIL) {
+		result += " empty";
+	} else {
+		int64_t place = user_place + 1;
+		for (; cur_board_down != rating::NIL; cur_board_down = m_board.Worse(cur_board_down)) {
+			AppendLine(result, cur_board_down, place);
+
+			++place;
+			if (place > user_place + MAX_NEIGHBOURS)
+				break;
+		}
+	}
+}
+
+/*
+ * Вызывается при user_registered
+ */
+void LeaderBoard::AddUser(const int64_t id, string_view name) {
+	lock_guard<shared_mutex> cs(m_mutex);
+
+	if (m_users.Find(id) != flat::Index::NONE)
+		throw err::Error("exists", "user_id", str::Str(id));
+
+	m_names.Add(name);
+	m_users.Insert(id, static_cast<uint32_t>(m_names.Size() - 1));
+
+	//новый пользователь встает в конец таблицы
+	auto user_pos = m_board.Add(0);
+
+	if (IsLeader(user_pos))
+		++m_leaders_version;
+	PublishLeaders();
+
+	//DebugContents();
+}
+
+/*
+ * Вызывается при user_renamed
+ */
+void LeaderBoard::RenameUser(const int64_t id, string_view new_name) {
+	lock_guard<shared_mutex> cs(m_mutex);
+
+	auto user_pos = FindUser(id);
+	m_names.Set(user_pos, new_name);
+
+	if (IsLeader(user_pos))
+		++m_leaders_version;
+	PublishLeaders();
+}
+
+/*
+ * Вызывается при user_deal_won
+ */
+void LeaderBoard::AddWin(const int64_t id, const date::SystemTimePoint &date, double amount) {
+	TRACE_SCOPE("LeaderBoard::AddWin");
+	TRACE_ARG(id);
+	lock_guard<shared_mutex> cs(m_mutex);
+
+	CheckWeeklyDrop();
+
+	if (date < m_week_begin || date > m_week_end)
+		throw err::Error("not_this_week", "date", date::Format(date));
+
+	ApplyWin(FindUser(id), amount);
+	PublishLeaders();
+
+	//DebugContents();
+}
+
+/*
+ * Пачка user_deal_won под одной блокировкой
+ * Выигрыши одного пользователя суммируются и применяются одной перестановкой в таблице.
+ * Суммы применяются в порядке последнего выигрыша каждого пользователя в пачке - при равных суммах
+ * места те же, что и при применении выигрышей по одному (позже получивший сумму ниже).
+ * Ошибочные выигрыши пропускаются с тем же сообщением, что и при AddWin
+ */
+void LeaderBoard::AddWins(vector<Win> &wins) {
+	if (wins.empty())
+		return;
+
+	TRACE_SCOPE("LeaderBoard::AddWins");
+	TRACE_ARG(wins.size());
+
+	//номера выигрышей, сгруппированные по пользователям, внутри пользователя - в порядке поступления
+	vector<uint32_t> order(wins.size());
+	iota(order.begin(), order.end(), 0);
+	stable_sort(order.begin(), order.end(), [&wins](uint32_t a, uint32_t b) {
+		return wins[a].id < wins[b].id;
+	});
+
+	struct Total {
+		uint32_t last;
+		rating::Handle user_pos;
+		double amount;
+	};
+	vector<Total> totals;
+
+	lock_guard<shared_mutex> cs(m_mutex);
+
+	CheckWeeklyDrop();
+
+	auto user_pos = rating::NIL;
+	double amount = 0;
+	for (size_t cnt = 0; cnt < order.size(); ++cnt) {
+		const Win &win = wins[order[cnt]];
+		try {
+			if (win.date < m_week_begin || win.date > m_week_end)
+				throw err::Error("not_this_week", "date", date::Format(win.date));
+
+			if (user_pos == rating::NIL || m_users.Id(user_pos) != win.id)
+				user_pos = FindUser(win.id);
+
+			amount += win.amount;
+		} catch(const err::Error& e) {
+			Debug("Failed to process request: " + string(e.what()));
+		}
+
+		bool last_of_user = cnt + 1 == order.size() || wins[order[cnt + 1]].id != win.id;
+		if (last_of_user) {
+			if (amount > 0 && user_pos != rating::NIL)
+				totals.push_back(Total{order[cnt], user_pos, amount});
+			amount = 0;
+		}
+	}
+
+	sort(totals.begin(), totals.end(), [](const Total &a, const Total &b) {
+		return a.last < b.last;
+	});
+	for (auto &total : totals)
+		ApplyWin(total.user_pos, total.amount);
+	PublishLeaders();
+
+	//DebugContents();
+}
+
+/*
+ * Образ: границы недели, дерево, затем id и имена пользователей по номерам
+ */
+void LeaderBoard::Save(string &image) const {
+	shared_lock<shared_mutex> cs(m_mutex);
+
+	bin::Put(image, static_cast<int64_t>(m_week_begin.time_since_epoch().count()));
+	bin::Put(image, static_cast<int64_t>(m_week_end.time_since_epoch().count()));
+	m_board.Save(image);
+
+	const uint32_t count = static_cast<uint32_t>(m_names.Size());
+	for (uint32_t user_pos = 0; user_pos < count; ++user_pos)
+		bin::Put(image, m_users.Id(user_pos));
+
+	uint64_t names_size = 0;
+	for (uint32_t user_pos = 0; user_pos < count; ++user_pos) {
+		names_size += m_names.Get(user_pos).size();
+		bin::Put(image, static_cast<uint32_t>(m_names.Get(user_pos).size()));
+	}
+
+	image.reserve(image.size() + names_size);
+	for (uint32_t user_pos = 0; user_pos < count; ++user_pos)
+		image += m_names.Get(user_pos);
+}
+
+void LeaderBoard::Load(string_view &image) {
+	lock_guard<shared_mutex> cs(m_mutex);
+
+	int64_t week_begin = 0;
+	int64_t week_end = 0;
+	if (!bin::Get(image, week_begin) || !bin::Get(image, week_end))
+		throw err::Error("corrupted", "snapshot", "leaderboard");
+	m_week_begin = date::SystemTimePoint(date::SystemTimePoint::duration(week_begin));
+	m_week_end = date::SystemTimePoint(date::SystemTimePoint::duration(week_end));
+
+	m_board.Load(image);
+
+	//массив id, массив длин имен, имена - одним блоком
+	const size_t count = m_board.Size();
+	if (image.size() / (sizeof(int64_t) + sizeof(uint32_t)) < count)
+		throw err::Error("corrupted", "snapshot", "users");
+
+	string_view ids = image.substr(0, count * sizeof(int64_t));
+	image.remove_prefix(count * sizeof(int64_t));
+
+	string_view sizes = image.substr(0, count * sizeof(uint32_t));
+	image.remove_prefix(count * sizeof(uint32_t));
+
+	m_users.Clear();
+	m_users.Reserve(count);
+	m_names.Clear();
+	m_names.Reserve(count);
+	for (size_t user_pos = 0; user_pos < count; ++user_pos) {
+		int64_t id = 0;
+		uint32_t name_size = 0;
+		bin::Get(ids, id);
+		bin::Get(sizes, name_size);
+		if (image.size() < name_size)
+			throw err::Error("corrupted", "snapshot", "users");
+
+		m_names.Add(image.substr(0, name_size));
+		image.remove_prefix(name_size);
+
+		if (!m_users.Insert(id, static_cast<uint32_t>(user_pos)))
+			throw err::Error("corrupted", "snapshot", str::Str(id));
+	}
+
+	++m_leaders_version;
+	PublishLeaders();
+}
+
+/*
+ * Шаг уплотнения имен - вызывается, когда входящих сообщений нет
+ * Возвращает true, если что-то освобождено и стоит вызвать еще раз
+ */
+bool LeaderBoard::CompactNames() {
+	{
+		shared_lock<shared_mutex> cs(m_mutex);
+		if (!m_names.CompactDue())
+			return false;
+	}
+
+	lock_guard<shared_mutex> cs(m_mutex);
+	return m_names.CompactStep();
+}
+
+rating::Handle LeaderBoard::FindUser(const int64_t id) const {
+	uint32_t user_pos = m_users.Find(id);
+	if (user_pos == flat::Index::NONE)
+		throw err::Error("missed", "user_id", str::Str(id));
+	return user_pos;
+}
+
+/*
+ * То же на пути чтения: смена недели - единственная запись там, для нее shared-блокировка
+ * временно меняется на эксклюзивную
+ */
+void LeaderBoard::CheckWeeklyDrop(shared_lock<shared_mutex> &cs) {
+	if (chrono::system_clock::now() <= m_week_end)
+		return;
+
+	cs.unlock();
+	{
+		lock_guard<shared_mutex> drop_cs(m_mutex);
+		CheckWeeklyDrop();
+	}
+	cs.lock();
+}
+
+/*
+ * Вызывается под эксклюзивной блокировкой
+ */
+void LeaderBoard::CheckWeeklyDrop() {
+	if (chrono::system_clock::now() <= m_week_end)
+		return;
+
+	//суммы прошлой недели читаются как 0 - обход таблицы не нужен
+	m_board.NextEpoch();
+	++m_leaders_version;
+	PublishLeaders();
+
+	m_week_begin = date::GetWeekBegin();
+	m_week_end = date::GetWeekEnd();
+}
+
+/*
+ * Вызывается под эксклюзивной блокировкой
+ */
+void LeaderBoard::ApplyWin(rating::Handle user_pos, double amount) {
+	bool was_leader = IsLeader(user_pos);
+	m_board.Update(user_pos, m_board.Amount(user_pos) + amount);
+
+	if (was_leader || IsLeader(user_pos))
+		++m_leaders_version;
+}
+
+bool LeaderBoard::IsLeader(rating::Handle user_pos) const {
+	return m_board.Place(user_pos) <= MAX_NEIGHBOURS;
+}
+
+/*
+ * Вызывается под эксклюзивной блокировкой в конце изменения таблицы: блок лидеров строится заново,
+ * только если сменилась версия. Чтение статистики берет готовый блок без своей блокировки
+ */
+void LeaderBoard::PublishLeaders() {
+	if (m_leaders_block_version == m_leaders_version)
+		return;
+
+	m_leaders_block.clear();
+	AppendLeaders(m_leaders_block);
+	m_leaders_block_version = m_leaders_version;
+}
+
+void LeaderBoard::AppendLeaders(string &result) const {
+	result += "\nLeaders:";
+	int64_t leader_place = 1;
+	for (auto lead = m_board.Top(); lead != rating::NIL; lead = m_board.Worse(lead)) {
+		AppendLine(result, lead, leader_place);
+
+		++leader_place;
+		if (leader_place > MAX_NEIGHBOURS)
+			break;
+	}
+}
+
+/*
+ * Вызывается под shared-блокировкой. Обходит то же окно, что и RenderStat: место пользователя
+ * задает места всех строк, узлы соседей - их суммы и имена
+ */
+uint64_t LeaderBoard::Fingerprint(rating::Handle user_pos) const {
+	uint64_t hash = 0;
+	auto mix = [&hash](uint64_t val) {
+		hash = (hash ^ val) * 0x9E3779B97F4A7C15ull;
+		hash ^= hash >> 32;
+	};
+	auto mix_user = [this, &mix](rating::Handle pos) {
+		double amount = m_board.Amount(pos);
+		uint64_t bits = 0;
+		memcpy(&bits, &amount, sizeof(bits));
+		mix(pos);
+		mix(bits);
+		mix(std::hash<string_view>()(m_names.Get(pos)));
+	};
+
+	//блок лидеров меняется только вместе с версией
+	mix(m_leaders_version);
+	mix(static_cast<uint64_t>(m_board.Place(user_pos)));
+	mix_user(user_pos);
+
+	int count = 0;
+	for (auto cur = m_board.Better(user_pos); cur != rating::NIL && count < MAX_NEIGHBOURS; cur = m_board.Better(cur), ++count)
+		mix_user(cur);
+	mix(rating::NIL);
+
+	count = 0;
+	for (auto cur = m_board.Worse(user_pos); cur != rating::NIL && count < MAX_NEIGHBOURS; cur = m_board.Worse(cur), ++count)
+		mix_user(cur);
+
+	return hash ? hash : 1;
+}
+
+/*
+ * Хеш содержимого строки: узел (он же id), сумма и имя. Не бывает нулем
+ */
+uint64_t LeaderBoard::RowHash(rating::Handle user_pos) const {
+	double amount = m_board.Amount(user_pos);
+	uint64_t bits = 0;
+	memcpy(&bits, &amount, sizeof(bits));
+
+	uint64_t hash = (user_pos + 1) * 0x9E3779B97F4A7C15ull;
+	hash = (hash ^ bits) * 0x9E3779B97F4A7C15ull;
+	hash = (hash ^ std::hash<string_view>()(m_names.Get(user_pos))) * 0x9E3779B97F4A7C15ull;
+	hash ^= hash >> 32;
+	return hash ? hash : 1;
+}
+
+/*
+ * Вызывается под shared-блокировкой. Кроме хешей возвращает узлы строк - для вывода изменившихся
+ */
+void LeaderBoard::FillView(rating::Handle user_pos, View &view, rating::Handle *leaders, rating::Handle *window) const {
+	view.week = m_week_begin.time_since_epoch().count();
+	view.place = m_board.Place(user_pos);
+
+	auto lead = m_board.Top();
+	for (int pos = 0; pos < MAX_NEIGHBOURS; ++pos) {
+		leaders[pos] = lead;
+		view.leaders[pos] = lead == rating::NIL ? 0 : RowHash(lead);
+		if (lead != rating::NIL)
+			lead = m_board.Worse(lead);
+	}
+
+	window[MAX_NEIGHBOURS] = user_pos;
+	view.window[MAX_NEIGHBOURS] = RowHash(user_pos);
+
+	auto up = m_board.Better(user_pos);
+	auto down = m_board.Worse(user_pos);
+	for (int pos = 1; pos <= MAX_NEIGHBOURS; ++pos) {
+		window[MAX_NEIGHBOURS - pos] = up;
+		view.window[MAX_NEIGHBOURS - pos] = up == rating::NIL ? 0 : RowHash(up);
+		if (up != rating::NIL)
+			up = m_board.Better(up);
+
+		window[MAX_NEIGHBOURS + pos] = down;
+		view.window[MAX_NEIGHBOURS + pos] = down == rating::NIL ? 0 : RowHash(down);
+		if (down != rating::NIL)
+			down = m_board.Worse(down);
+	}
+}
+
+/*
+ * "\n<место>. <имя> (id:<id>)  <сумма>"
+ */
+void LeaderBoard::AppendLine(string &dst, rating::Handle user_pos, int64_t place) const {
+	dst += '\n';
+	str::Append(dst, place);
+	dst += ". ";
+	dst += m_names.Get(user_pos);
+	dst += " (id:";
+	str::Append(dst, m_users.Id(user_pos));
+	dst += ")  ";
+	str::Append(dst, m_board.Amount(user_pos), 2);
+}
+
+void LeaderBoard::DebugContents() const {
+	Debug("Board contents:");
+
+	int64_t place = 1;
+	string line;
+	for (auto cur = m_board.Top(); cur != rating::NIL; cur = m_board.Worse(cur)) {
+		line.clear();
+		AppendLine(line, cur, place++);
+		Debug("\t" + line.substr(1));
+	}
+}
@@ -0,0 +1,182 @@
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <lb_defines.h>
+#include <lb_error.h>
+#include <lb_histogram.h>
+#include <lb_metrics.h>
+
+using namespace std;
+
+namespace metrics {
+namespace {
+const string NAMES[METRICS] = {
+	"apply_register_ns",
+	"apply_rename_ns",
+	"apply_won_batch_avg_ns",
+	"apply_connect_ns",
+	"apply_disconnect_ns",
+	"render_ns",
+	"reminder_due_users",
+	"reminder_lateness_us",
+	"producer_queue_messages",
+	"producer_delay_us",
+	"publish_ns"
+};
+
+/*
+ * Счетчики корзин одной метрики одного потока. counts пишет только поток-владелец
+ * (load + store без атомарного сложения), reported - только отчет
+ */
+struct Recorder {
+	unique_ptr<atomic<uint64_t>[]> counts;
+	vector<uint64_t> reported;
+
+	Recorder()
+	: counts(new atomic<uint64_t>[hist::Histogram::Buckets()])
+	, reported(hist::Histogram::Buckets(), 0) {
+		for (size_t bucket = 0; bucket < hist::Histogram::Buckets(); ++bucket)
+			counts[bucket].store(0, memory_order_relaxed);
+	}
+};
+
+//метрики потока создаются при первой записи в них
+struct Shard {
+	atomic<Recorder *> recorders[METRICS];
+	uint64_t events;
+
+	Shard() : events(0) {
+		for (auto &recorder : recorders)
+			recorder.store(nullptr, memory_order_relaxed);
+	}
+};
+
+atomic_bool enabled(false);
+
+//потоки не освобождают свои записи при завершении - их счетчики остаются в отчетах
+mutex shards_mutex;
+vector<unique_ptr<Shard>> shards;
+vector<unique_ptr<Recorder>> recorders;
+date::SteadyTimePoint reported;
+
+thread_local Shard *local = nullptr;
+
+Shard &Local() {
+	if (!local) {
+		lock_guard<mutex> cs(shards_mutex);
+		shards.emplace_back(new Shard());
+		local = shards.back().get();
+	}
+	return *local;
+}
+
+string Number(uint64_t value) {
+	return str::Str(static_cast<int64_t>(value));
+}
+} //end of anonymous namespace
+
+/*
+ * Вызывается до запуска потоков
+ */
+void Enable() {
+	reported = chrono::steady_clock::now();
+	enabled = true;
+}
+
+//записанное остается в отчетах
+void Disable() {
+	enabled = false;
+}
+
+bool Enabled() {
+	return enabled.load(memory_order_relaxed);
+}
+
+bool Sample() {
+	if (!Enabled())
+		return false;
+	return (++Local().events & (METRICS_SAMPLE - 1)) == 0;
+}
+
+void Add(Metric metric, uint64_t value, uint64_t count) {
+	if (!Enabled())
+		return;
+
+	Shard &shard = Local();
+	Recorder *recorder = shard.recorders[metric].load(memory_order_relaxed);
+	if (!recorder) {
+		lock_guard<mutex> cs(shards_mutex);
+		recorders.emplace_back(new Recorder());
+		recorder = recorders.back().get();
+		shard.recorders[metric].store(recorder, memory_order_release);
+	}
+
+	auto &bucket = recorder->counts[hist::Histogram::Bucket(value)];
+	bucket.store(bucket.load(memory_order_relaxed) + count, memory_order_relaxed);
+}
+
+uint64_t Nanoseconds(const date::SteadyTimePoint &begin) {
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - begin).count();
+}
+
+uint64_t Microseconds(const date::SteadyTimePoint &begin) {
+	return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin).count();
+}
+
+/*
+ * Интервал складывается из разностей счетчиков корзин с прошлого отчета. Значения в отчете -
+ * верхние границы корзин, как у перцентилей hist::Histogram
+ */
+string Report() {
+	lock_guard<mutex> cs(shards_mutex);
+	auto now = chrono::steady_clock::now();
+	double secs = chrono::duration<double>(now - reported).count();
+	reported = now;
+
+	string report = "# metric interval total per_sec p50 p99 p99.9 max\n";
+	hist::Histogram interval;
+	for (int metric = 0; metric < METRICS; ++metric) {
+		interval.Clear();
+		uint64_t total = 0;
+		for (auto &shard : shards) {
+			Recorder *recorder = shard->recorders[metric].load(memory_order_acquire);
+			if (!recorder)
+				continue;
+
+			for (size_t bucket = 0; bucket < hist::Histogram::Buckets(); ++bucket) {
+				uint64_t count = recorder->counts[bucket].load(memory_order_relaxed);
+				total += count;
+				if (count == recorder->reported[bucket])
+					continue;
+				interval.Add(hist::Histogram::Highest(bucket), count - recorder->reported[bucket]);
+				recorder->reported[bucket] = count;
+			}
+		}
+		if (total == 0)
+			continue;
+
+		report += NAMES[metric] + " " + Number(interval.Count()) + " " + Number(total) + " " +
+				str::Str(secs > 0 ? interval.Count() / secs : 0, 0) + " " +
+				Number(interval.Percentile(0.5)) + " " + Number(interval.Percentile(0.99)) + " " +
+				Number(interval.Percentile(0.999)) + " " + Number(interval.Max()) + "\n";
+	}
+	return report;
+}
+
+void Write(const string &path) {
+	const string report = Report();
+	const string tmp_path = path + ".tmp";
+
+	FILE *file = fopen(tmp_path.c_str(), "wb");
+	if (!file)
+		throw err::Error("failed", "metrics", tmp_path);
+
+	bool written = fwrite(report.data(), 1, report.size(), file) == report.size();
+	written = fclose(file) == 0 && written;
+	if (!written || rename(tmp_path.c_str(), path.c_str()) != 0)
+		throw err::Error("failed", "metrics", tmp_path);
+}
+} //end of metrics namespace
@@ -0,0 +1,258 @@
+#include <lb_error.h>
+#include <lb_functions.h>
+#include <lb_metrics.h>
+#include <lb_producer.h>
+#include <lb_trace.h>
+
+using namespace std;
+
+namespace {
+//Take: в полосе нет живых сообщений
+const uint32_t NONE = UINT32_MAX;
+
+bool Supersedable(Producer::Message::Kind kind) {
+	return kind == Producer::Message::FULL || kind == Producer::Message::HEARTBEAT;
+}
+} //end of anonymous namespace
+
+Producer::Producer(const Publisher &publisher, int high_weight, int bulk_weight, size_t limit, Overflow overflow)
+: m_publisher(publisher)
+, m_limit(limit)
+, m_overflow(overflow)
+, m_stopped(false)
+, m_removed(0)
+, m_max_queued(0)
+, m_superseded(0)
+, m_dropped_count(0)
+, m_blocked(0) {
+	if (high_weight < 1 || bulk_weight < 1)
+		throw err::Error("invalid", "producer weight", str::Str(int64_t(min(high_weight, bulk_weight))));
+	if (limit < 1)
+		throw err::Error("invalid", "producer limit", str::Str(int64_t(limit)));
+
+	m_quota[HIGH] = static_cast<size_t>(high_weight) * PRODUCER_ROUND_SIZE;
+	m_quota[BULK] = static_cast<size_t>(bulk_weight) * PRODUCER_ROUND_SIZE;
+}
+
+/*
+ * Задается до запуска. dropped вызывается без блокировки очереди, из потока, добавлявшего сообщения
+ */
+void Producer::OnDropped(const Dropped &dropped) {
+	m_dropped = dropped;
+}
+
+void Producer::AddMessage(const string &msg, Lane lane) {
+	AddMessage(string(msg), lane);
+}
+
+void Producer::AddMessage(string &&msg, Lane lane) {
+	Messages messages;
+	messages.push_back(Message{0, Message::OTHER, move(msg)});
+	AddMessages(messages, lane);
+}
+
+/*
+ * Забирает строки пачки под одну блокировку
+ */
+void Producer::AddMessages(Messages &messages, Lane lane) {
+	if (messages.empty())
+		return;
+
+	vector<int64_t> dropped;
+	bool added = false;
+	//время постановки замеряется выборочно: часы читаются для одной пачки из METRICS_SAMPLE
+	const auto queued = metrics::Sample() ? chrono::steady_clock::now() : date::SteadyTimePoint();
+	{
+		unique_lock<mutex> cs(m_data_mutex);
+		for (auto &msg : messages)
+			added = Push(cs, move(msg), lane, queued, dropped) || added;
+	}
+
+	//поток отправки ждет только на пустой очереди, лишнее уведомление дешевле проверки
+	if (added)
+		m_can_process.notify_one();
+
+	if (m_dropped) {
+		for (auto user : dropped)
+			m_dropped(user);
+	}
+}
+
+void Producer::SendMessages() {
+	TRACE_THREAD("producer");
+	Batch batch;
+	//время постановки замеряемых сообщений раунда
+	vector<date::SteadyTimePoint> sampled;
+	while(true) {
+		{
+			unique_lock<mutex> wait_lock(m_data_mutex);
+			while(!m_stopped && Size() == 0) {
+				m_can_process.wait(wait_lock);
+			}
+
+			if (m_stopped)
+				return;
+
+			if (metrics::Enabled())
+				metrics::Add(metrics::PRODUCER_QUEUE, Size());
+			for (int lane = 0; lane < LANES; ++lane) {
+				for (size_t cnt = 0; cnt < m_quota[lane]; ++cnt) {
+					uint32_t item = Take(static_cast<Lane>(lane));
+					if (item == NONE)
+						break;
+					if (m_queued_at[item] != date::SteadyTimePoint())
+						sampled.push_back(m_queued_at[item]);
+					batch.push_back(move(m_items[item].body));
+					m_free_items.push_back(item);
+				}
+			}
+		}
+		if (m_overflow == Overflow::BLOCK)
+			m_can_add.notify_all();
+
+		const bool timed = metrics::Enabled();
+		const auto begin = timed ? chrono::steady_clock::now() : date::SteadyTimePoint();
+		{
+			TRACE_SCOPE("Producer::Publish");
+			TRACE_ARG(batch.size());
+			m_publisher(batch);
+		}
+		batch.clear();
+
+		if (timed) {
+			const auto published = chrono::steady_clock::now();
+			metrics::Add(metrics::PUBLISH, chrono::duration_cast<chrono::nanoseconds>(published - begin).count());
+			for (auto &queued : sampled)
+				metrics::Add(metrics::PRODUCER_DELAY, chrono::duration_cast<chrono::microseconds>(published - queued).count());
+		}
+		sampled.clear();
+	}
+}
+
+void Producer::Stop() {
+	{
+		lock_guard<mutex> cs(m_data_mutex);
+		m_stopped = true;
+	}
+	m_can_process.notify_one();
+	m_can_add.notify_all();
+}
+
+Producer::Counters Producer::GetCounters() {
+	lock_guard<mutex> cs(m_data_mutex);
+	return Counters{Size(), m_max_queued, m_superseded, m_dropped_count, m_blocked};
+}
+
+void Producer::Report() {
+	auto counters = GetCounters();
+	Debug("Producer: queued " + str::Str((int64_t)counters.queued) +
+			" (max " + str::Str((int64_t)counters.max_queued) + ")" +
+			", superseded " + str::Str((int64_t)counters.superseded) +
+			", dropped " + str::Str((int64_t)counters.dropped) +
+			", blocked " + str::Str((int64_t)counters.blocked));
+}
+
+/*
+ * Вызывается под m_data_mutex. Возвращает false, если сообщение не добавило новой записи в очередь
+ */
+bool Producer::Push(unique_lock<mutex> &cs, Message &&msg, Lane lane, const date::SteadyTimePoint &queued,
+		vector<int64_t> &dropped) {
+	//после ожидания места очередь могла измениться - замена проверяется заново
+	while (true) {
+		if (Supersedable(msg.kind)) {
+			uint32_t existing = m_users.Find(msg.user);
+			if (existing != flat::Index::NONE && lane == HIGH && msg.kind == Message::FULL
+					&& m_item_lanes[existing] == BULK) {
+				//полное из HIGH не занимает место в BULK: старое помечается снятым (его пропустит Take),
+				//новое встает в свою полосу
+				m_users.Erase(msg.user);
+				m_items[existing].body = string();
+				m_item_lanes[existing] = LANES;
+				++m_removed;
+				++m_superseded;
+			} else if (existing != flat::Index::NONE) {
+				//"без изменений" после стоящего в очереди сообщения ничего не добавляет,
+				//полное из BULK на месте сообщения в HIGH уходит только раньше
+				if (msg.kind == Message::FULL)
+					m_items[existing] = move(msg);
+				++m_superseded;
+				return false;
+			}
+		} else if (msg.kind == Message::DELTA) {
+			//разность должна уйти после всего, что уже стоит в очереди, - заменять там больше нечего
+			m_users.Erase(msg.user);
+		}
+
+		if (Size() < m_limit || m_stopped)
+			break;
+
+		if (m_overflow == Overflow::BLOCK) {
+			++m_blocked;
+			m_can_process.notify_one();
+			m_can_add.wait(cs);
+			continue;
+		}
+
+		uint32_t oldest = Take(BULK);
+		if (oldest == NONE)
+			oldest = Take(HIGH);
+		if (m_items[oldest].kind != Message::OTHER)
+			dropped.push_back(m_items[oldest].user);
+		m_items[oldest].body = string();
+		m_free_items.push_back(oldest);
+		++m_dropped_count;
+	}
+	if (m_stopped)
+		return false;
+
+	uint32_t item;
+	if (m_free_items.empty()) {
+		item = static_cast<uint32_t>(m_items.size());
+		m_items.push_back(move(msg));
+		m_queued_at.push_back(queued);
+		m_item_lanes.push_back(lane);
+	} else {
+		item = m_free_items.back();
+		m_free_items.pop_back();
+		m_items[item] = move(msg);
+		m_queued_at[item] = queued;
+		m_item_lanes[item] = lane;
+	}
+
+	m_lanes[lane].push_back(item);
+	if (Supersedable(m_items[item].kind))
+		m_users.Insert(m_items[item].user, item);
+
+	m_max_queued = max<uint64_t>(m_max_queued, Size());
+	return true;
+}
+
+/*
+ * Вызывается под m_data_mutex. Снимает номер первого живого сообщения полосы, сообщение остается в пуле.
+ * Снятые заменой по дороге освобождаются. NONE - если живых в полосе нет
+ */
+uint32_t Producer::Take(Lane lane) {
+	while (!m_lanes[lane].empty()) {
+		uint32_t item = m_lanes[lane].front();
+		m_lanes[lane].pop_front();
+
+		if (m_item_lanes[item] == LANES) {
+			--m_removed;
+			m_free_items.push_back(item);
+			continue;
+		}
+
+		const Message &msg = m_items[item];
+		if (Supersedable(msg.kind) && m_users.Find(msg.user) == item)
+			m_users.Erase(msg.user);
+		return item;
+	}
+	return NONE;
+}
+
+/*
+ * Вызывается под m_data_mutex
+ */
+size_t Producer::Size() const {
+	return m_lanes[HIGH].size() + m_lanes[BULK].size() - m_removed;
+}
@@ -0,0 +1,250 @@
+#include <lb_error.h>
+#include <lb_functions.h>
+#include <lb_rating.h>
+
+using namespace std;
+
+namespace rating {
+Tree::Tree()
+: m_root(NIL)
+, m_seq(0)
+, m_epoch(1)
+, m_random(2463534242u) {}
+
+Handle Tree::Add(double amount) {
+	Handle h = static_cast<Handle>(m_nodes.size());
+	Node node;
+	node.amount = amount;
+	node.seq = ++m_seq;
+	node.epoch = amount > 0 ? m_epoch : 0; //без выигрышей - ниже всех, кто выигрывал
+	node.priority = NextPriority();
+	m_nodes.push_back(node);
+
+	Link(h);
+	return h;
+}
+
+void Tree::Update(Handle h, double amount) {
+	m_nodes[h].amount = amount;
+	m_nodes[h].seq = ++m_seq;
+	m_nodes[h].epoch = m_epoch;
+
+	//соседи остались по разные стороны - перестраивать дерево не нужно
+	Handle better = Better(h);
+	Handle worse = Worse(h);
+	if ((better == NIL || Less(h, better)) && (worse == NIL || Less(worse, h)))
+		return;
+
+	Unlink(h);
+	Link(h);
+}
+
+void Tree::NextEpoch() {
+	++m_epoch;
+}
+
+double Tree::Amount(Handle h) const {
+	const Node &node = m_nodes[h];
+	return node.epoch == m_epoch ? node.amount : 0;
+}
+
+int64_t Tree::Place(Handle h) const {
+	//количество элементов ниже текущего
+	int64_t less = SizeOf(m_nodes[h].left);
+	for (Handle cur = h; m_nodes[cur].parent != NIL; cur = m_nodes[cur].parent) {
+		Handle parent = m_nodes[cur].parent;
+		if (m_nodes[parent].right == cur)
+			less += SizeOf(m_nodes[parent].left) + 1;
+	}
+	return static_cast<int64_t>(m_nodes.size()) - less;
+}
+
+std::size_t Tree::Size() const {
+	return m_nodes.size();
+}
+
+Handle Tree::Top() const {
+	Handle cur = m_root;
+	while (cur != NIL && m_nodes[cur].right != NIL)
+		cur = m_nodes[cur].right;
+	return cur;
+}
+
+Handle Tree::Bottom() const {
+	Handle cur = m_root;
+	while (cur != NIL && m_nodes[cur].left != NIL)
+		cur = m_nodes[cur].left;
+	return cur;
+}
+
+Handle Tree::Better(Handle h) const {
+	Handle cur = m_nodes[h].right;
+	if (cur != NIL) {
+		while (m_nodes[cur].left != NIL)
+			cur = m_nodes[cur].left;
+		return cur;
+	}
+
+	cur = h;
+	Handle parent = m_nodes[cur].parent;
+	while (parent != NIL && m_nodes[parent].right == cur) {
+		cur = parent;
+		parent = m_nodes[cur].parent;
+	}
+	return parent;
+}
+
+Handle Tree::Worse(Handle h) const {
+	Handle cur = m_nodes[h].left;
+	if (cur != NIL) {
+		while (m_nodes[cur].right != NIL)
+			cur = m_nodes[cur].right;
+		return cur;
+	}
+
+	cur = h;
+	Handle parent = m_nodes[cur].parent;
+	while (parent != NIL && m_nodes[parent].left == cur) {
+		cur = parent;
+		parent = m_nodes[cur].parent;
+	}
+	return parent;
+}
+
+void Tree::Save(std::string &image) const {
+	bin::Put(image, m_root);
+	bin::Put(image, m_seq);
+	bin::Put(image, m_epoch);
+	bin::Put(image, m_random);
+	bin::Put(image, static_cast<uint64_t>(m_nodes.size()));
+	image.append(reinterpret_cast<const char *>(m_nodes.data()), m_nodes.size() * sizeof(Node));
+}
+
+void Tree::Load(std::string_view &image) {
+	uint64_t count = 0;
+	if (!bin::Get(image, m_root) || !bin::Get(image, m_seq) || !bin::Get(image, m_epoch) ||
+			!bin::Get(image, m_random) || !bin::Get(image, count) || image.size() / sizeof(Node) < count)
+		throw err::Error("corrupted", "snapshot", "rating");
+
+	m_nodes.resize(count);
+	memcpy(m_nodes.data(), image.data(), count * sizeof(Node));
+	image.remove_prefix(count * sizeof(Node));
+
+	//ссылки узлов дальше используются как индексы без проверок
+	auto valid = [count](Handle h) { return h == NIL || h < count; };
+	bool linked = valid(m_root) && (count != 0 || m_root == NIL);
+	for (auto &node : m_nodes)
+		linked = linked && valid(node.left) && valid(node.right) && valid(node.parent);
+	if (!linked) {
+		m_nodes.clear();
+		m_root = NIL;
+		throw err::Error("corrupted", "snapshot", "rating");
+	}
+}
+
+bool Tree::Less(Handle a, Handle b) const {
+	const Node &na = m_nodes[a];
+	const Node &nb = m_nodes[b];
+	if (na.epoch != nb.epoch)
+		return na.epoch < nb.epoch;
+	if (na.amount != nb.amount)
+		return na.amount < nb.amount;
+	return na.seq > nb.seq;
+}
+
+uint32_t Tree::SizeOf(Handle h) const {
+	return h == NIL ? 0 : m_nodes[h].size;
+}
+
+uint32_t Tree::NextPriority() {
+	//xorshift32 - приоритеты нужны лишь псевдослучайные
+	m_random ^= m_random << 13;
+	m_random ^= m_random >> 17;
+	m_random ^= m_random << 5;
+	return m_random;
+}
+
+/*
+ * Поднимает h на место его родителя
+ */
+void Tree::Rotate(Handle h) {
+	Node &node = m_nodes[h];
+	Handle parent = node.parent;
+	Node &pnode = m_nodes[parent];
+	Handle grand = pnode.parent;
+
+	if (pnode.left == h) {
+		pnode.left = node.right;
+		if (node.right != NIL)
+			m_nodes[node.right].parent = parent;
+		node.right = parent;
+	} else {
+		pnode.right = node.left;
+		if (node.left != NIL)
+			m_nodes[node.left].parent = parent;
+		node.left = parent;
+	}
+
+	pnode.parent = h;
+	node.parent = grand;
+	if (grand == NIL)
+		m_root = h;
+	else if (m_nodes[grand].left == parent)
+		m_nodes[grand].left = h;
+	else
+		m_nodes[grand].right = h;
+
+	node.size = pnode.size;
+	pnode.size = SizeOf(pnode.left) + SizeOf(pnode.right) + 1;
+}
+
+void Tree::Link(Handle h) {
+	m_nodes[h].left = NIL;
+	m_nodes[h].right = NIL;
+	m_nodes[h].size = 1;
+
+	Handle parent = NIL;
+	bool to_left = false;
+	for (Handle cur = m_root; cur != NIL; ) {
+		++m_nodes[cur].size;
+		parent = cur;
+		to_left = Less(h, cur);
+		cur = to_left ? m_nodes[cur].left : m_nodes[cur].right;
+	}
+
+	m_nodes[h].parent = parent;
+	if (parent == NIL)
+		m_root = h;
+	else if (to_left)
+		m_nodes[parent].left = h;
+	else
+		m_nodes[parent].right = h;
+
+	while (m_nodes[h].parent != NIL && m_nodes[m_nodes[h].parent].priority < m_nodes[h].priority)
+		Rotate(h);
+}
+
+void Tree::Unlink(Handle h) {
+	//опускаем узел до листа, затем отцепляем
+	while (m_nodes[h].left != NIL || m_nodes[h].right != NIL) {
+		Handle left = m_nodes[h].left;
+		Handle right = m_nodes[h].right;
+		if (right == NIL || (left != NIL && m_nodes[left].priority > m_nodes[right].priority))
+			Rotate(left);
+		else
+			Rotate(right);
+	}
+
+	Handle parent = m_nodes[h].parent;
+	for (Handle cur = parent; cur != NIL; cur = m_nodes[cur].parent)
+		--m_nodes[cur].size;
+
+	if (parent == NIL)
+		m_root = NIL;
+	else if (m_nodes[parent].left == h)
+		m_nodes[parent].left = NIL;
+	else
+		m_nodes[parent].right = NIL;
+	m_nodes[h].parent = NIL;
+}
+} //end of rating namespace
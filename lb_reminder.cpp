@@ -0,0 +1,523 @@
+#include <lb_defines.h>
+#include <lb_error.h>
+#include <lb_metrics.h>
+#include <lb_reminder.h>
+#include <lb_trace.h>
+
+using namespace std;
+
+Reminder::Reminder(LeaderBoard &board, const Sender &sender, Unchanged unchanged, StatFormat format, int workers)
+: m_board(board)
+, m_sender(sender)
+, m_unchanged(unchanged)
+, m_format(format)
+, m_stamped(false)
+, m_slots(REMINDER_SLOTS + 1, NIL)
+, m_connected_slot(REMINDER_SLOTS)
+, m_start(chrono::steady_clock::now())
+, m_cursor(0)
+, m_stopped(false)
+, m_sent(0)
+, m_unchanged_count(0)
+, m_bytes(0)
+, m_job_due(nullptr)
+, m_job_views(nullptr)
+, m_job_next(0)
+, m_job_changed(0)
+, m_job_generation(0)
+, m_job_active(0)
+, m_pool_stopped(false)
+, m_pool_size(workers) {}
+
+Reminder::~Reminder() {
+	{
+		lock_guard<mutex> cs(m_pool_mutex);
+		m_pool_stopped = true;
+	}
+	m_pool_start.notify_all();
+
+	for (auto &worker : m_workers)
+		worker.join();
+}
+
+/*
+ * Вызывается при user_connected
+ */
+void Reminder::ConnectUser(const int64_t id, uint64_t token) {
+	{
+		lock_guard<mutex> cs(m_data_mutex);
+
+		uint32_t reminder = m_free.empty() ? static_cast<uint32_t>(m_reminders.size()) : m_free.back();
+		if (!m_users.Insert(id, reminder))
+			throw err::Error("already connected", "user_id", str::Str(id));
+
+		if (m_free.empty())
+			m_reminders.emplace_back();
+		else
+			m_free.pop_back();
+
+		m_reminders[reminder].id = id;
+		m_reminders[reminder].fingerprint = 0;
+		m_reminders[reminder].resync = false;
+		Link(reminder, m_connected_slot);
+
+		if (m_stamped) {
+			if (m_stamps.size() <= reminder)
+				m_stamps.resize(reminder + 1);
+			m_stamps[reminder].connected = chrono::duration_cast<chrono::microseconds>(
+					chrono::system_clock::now().time_since_epoch()).count();
+			m_stamps[reminder].token = token;
+		}
+	}
+
+	//запланируем сейчас и отменим ожидание следующего
+	m_can_process.notify_one();
+}
+
+/*
+ * Вызывается при user_disconnected
+ */
+void Reminder::DisconnectUser(const int64_t id) {
+	lock_guard<mutex> cs(m_data_mutex);
+
+	uint32_t reminder = m_users.Erase(id);
+	if (reminder == NIL)
+		return;
+
+	Unlink(reminder);
+	m_free.push_back(reminder);
+}
+
+/*
+ * Следующее сообщение пользователю будет полным
+ */
+void Reminder::Resync(const int64_t id) {
+	lock_guard<mutex> cs(m_data_mutex);
+
+	uint32_t reminder = m_users.Find(id);
+	if (reminder == NIL)
+		return;
+
+	m_reminders[reminder].fingerprint = 0;
+	m_reminders[reminder].resync = true;
+	if (reminder < m_views.size())
+		m_views[reminder].week = 0;
+}
+
+/*
+ * Метка входящего сообщения уйдет в штампе ближайшего сообщения пользователю
+ * Без штампов и для неподключенных ничего не делает
+ */
+void Reminder::Tag(const int64_t id, uint64_t token) {
+	lock_guard<mutex> cs(m_data_mutex);
+	if (!m_stamped)
+		return;
+
+	uint32_t reminder = m_users.Find(id);
+	if (reminder != NIL)
+		m_stamps[reminder].token = token;
+}
+
+/*
+ * Вызывается до начала обработки - до Process и подключений
+ */
+void Reminder::EnableStamps() {
+	lock_guard<mutex> cs(m_data_mutex);
+	m_stamped = true;
+	m_stamps.resize(m_reminders.size(), Stamp{0, 0});
+}
+
+/*
+ * Образ - только подключенные пользователи. После загрузки все они считаются
+ * подключившимися заново и получат сообщение в ближайший такт
+ */
+void Reminder::Save(string &image) {
+	lock_guard<mutex> cs(m_data_mutex);
+
+	bin::Put(image, static_cast<uint64_t>(m_users.Size()));
+	m_users.ForEach([&image](int64_t id, uint32_t) {
+		bin::Put(image, id);
+	});
+}
+
+void Reminder::Load(string_view &image) {
+	uint64_t count = 0;
+	if (!bin::Get(image, count) || image.size() / sizeof(int64_t) < count)
+		throw err::Error("corrupted", "snapshot", "reminder");
+
+	for (uint64_t cnt = 0; cnt < count; ++cnt) {
+		int64_t id = 0;
+		bin::Get(image, id);
+		ConnectUser(id);
+	}
+}
+
+void Reminder::Process() {
+	TRACE_THREAD("reminder");
+	while(true) {
+		if (m_stopped)
+			return;
+
+		date::SteadyTimePoint wake;
+		Tick(chrono::steady_clock::now(), wake);
+
+		unique_lock<mutex> wait_lock(m_data_mutex);
+		m_can_process.wait_until(wait_lock, wake, [this]() {
+			return m_stopped || m_slots[m_connected_slot] != NIL;
+		});
+	}
+}
+
+/*
+ * Отправляет сообщения всем, чьи такты наступили к моменту now, и новым подключениям
+ * Возвращает количество отправленных, в wake - время следующего пробуждения
+ */
+size_t Reminder::Tick(const date::SteadyTimePoint &now, date::SteadyTimePoint &wake) {
+	TRACE_SCOPE("Reminder::Tick");
+	vector<Due> due;
+	//опоздание самого старого из наступивших тактов
+	int64_t lateness = -1;
+
+	//чтобы не блокировать список юзеров лишнее время. Например во время построения и постановки сообщений в очередь
+	{
+		lock_guard<mutex> cs(m_data_mutex);
+		//DebugContents();
+
+		//новым подключениям - сообщение сейчас и первыми, следующее через оборот.
+		//В слот такта они переносятся после его обхода, чтобы не попасть в due дважды
+		int64_t now_tick = TickOf(now);
+		uint32_t connected = m_slots[m_connected_slot];
+		m_slots[m_connected_slot] = NIL;
+		for (uint32_t cur = connected; cur != NIL; cur = m_reminders[cur].next) {
+			due.push_back(Due{m_reminders[cur].id, 0, false, true, 0, 0});
+			if (m_stamped) {
+				due.back().scheduled = m_stamps[cur].connected;
+				due.back().token = m_stamps[cur].token;
+				m_stamps[cur].token = 0;
+			}
+		}
+
+		//такт колеса в мкс system_clock - для штампов
+		const int64_t system_offset = m_stamped ? chrono::duration_cast<chrono::microseconds>(
+				chrono::system_clock::now().time_since_epoch() - now.time_since_epoch()).count() : 0;
+
+		//пропущенные такты обрабатываем все, но не больше одного оборота
+		const int64_t first_tick = max(m_cursor, now_tick - REMINDER_SLOTS + 1);
+		if (first_tick <= now_tick)
+			lateness = chrono::duration_cast<chrono::microseconds>(
+					now - m_start - chrono::milliseconds(first_tick * REMINDER_TICK_MS)).count();
+		for (int64_t tick = first_tick; tick <= now_tick; ++tick) {
+			const int64_t scheduled = system_offset + chrono::duration_cast<chrono::microseconds>(
+					(m_start + chrono::milliseconds(tick * REMINDER_TICK_MS)).time_since_epoch()).count();
+			for (uint32_t cur = m_slots[tick % REMINDER_SLOTS]; cur != NIL; cur = m_reminders[cur].next) {
+				due.push_back(Due{m_reminders[cur].id, m_reminders[cur].fingerprint, false, false, 0, 0});
+				if (m_stamped) {
+					due.back().scheduled = scheduled;
+					due.back().token = m_stamps[cur].token;
+					m_stamps[cur].token = 0;
+				}
+			}
+		}
+		m_cursor = max(m_cursor, now_tick + 1);
+
+		while (connected != NIL) {
+			uint32_t cur = connected;
+			connected = m_reminders[cur].next;
+			Link(cur, now_tick % REMINDER_SLOTS);
+		}
+
+		wake = NextWake();
+	}
+	TRACE_ARG(due.size());
+
+	if (metrics::Enabled()) {
+		metrics::Add(metrics::REMINDER_DUE, due.size());
+		if (lateness >= 0)
+			metrics::Add(metrics::REMINDER_LATENESS, lateness);
+	}
+
+	//отправленные View копируются на время построения: запись может быть переиспользована
+	vector<LeaderBoard::View> views;
+	if (m_format == StatFormat::DELTA) {
+		lock_guard<mutex> cs(m_data_mutex);
+		views.resize(due.size());
+		for (size_t pos = 0; pos < due.size(); ++pos) {
+			uint32_t reminder = m_users.Find(due[pos].id);
+			if (due[pos].connected || reminder == NIL || reminder >= m_views.size())
+				views[pos].week = 0;
+			else
+				views[pos] = m_views[reminder];
+		}
+	}
+
+	const size_t changed = RenderAll(due, views);
+
+	//запоминаем отправленное. Если за это время пользователь переподключился, его сообщение
+	//все равно уйдет полностью - подключения не сверяются с отпечатком.
+	//Полные сообщения в режиме SEND ничего не запоминают - блокировка не нужна
+	if (changed > 0) {
+		lock_guard<mutex> cs(m_data_mutex);
+		for (size_t pos = 0; pos < due.size(); ++pos) {
+			auto &user = due[pos];
+			if (!user.changed)
+				continue;
+			uint32_t reminder = m_users.Find(user.id);
+			if (reminder == NIL)
+				continue;
+			if (m_reminders[reminder].resync) {
+				m_reminders[reminder].resync = false;
+				continue;
+			}
+
+			m_reminders[reminder].fingerprint = user.fingerprint;
+			if (m_format == StatFormat::DELTA) {
+				if (m_views.size() <= reminder)
+					m_views.resize(reminder + 1);
+				m_views[reminder] = views[pos];
+			}
+		}
+	}
+
+	return due.size();
+}
+
+/*
+ * Делит due на отрезки по REMINDER_BATCH_SIZE. Отрезки разбирают по очереди вызывающий поток
+ * и пул, поэтому медленные пользователи не задерживают остальных. Возвращает число изменившихся
+ */
+size_t Reminder::RenderAll(vector<Due> &due, vector<LeaderBoard::View> &views) {
+	m_job_due = &due;
+	m_job_views = views.empty() ? nullptr : &views;
+	m_job_next = 0;
+	m_job_changed = 0;
+
+	//пул будится только ради нескольких отрезков
+	bool parallel = m_pool_size > 1 && due.size() > static_cast<size_t>(REMINDER_BATCH_SIZE);
+	if (parallel && m_workers.empty())
+		StartPool();
+	if (parallel) {
+		lock_guard<mutex> cs(m_pool_mutex);
+		++m_job_generation;
+		m_job_active = m_workers.size();
+	}
+	if (parallel)
+		m_pool_start.notify_all();
+
+	RenderJob();
+
+	if (parallel) {
+		unique_lock<mutex> cs(m_pool_mutex);
+		m_pool_done.wait(cs, [this]() {
+			return m_job_active == 0;
+		});
+	}
+	return m_job_changed.load();
+}
+
+void Reminder::RenderJob() {
+	auto &due = *m_job_due;
+	string message;
+	Batch batch;
+	bool connected = false;
+	size_t changed = 0;
+	while (true) {
+		size_t begin = m_job_next.fetch_add(REMINDER_BATCH_SIZE);
+		if (begin >= due.size())
+			break;
+
+		//готовые сообщения уходят отправителю пачкой, по одной блокировке очереди на пачку.
+		//Подключения идут в due первыми и не смешиваются в пачке с периодической рассылкой
+		size_t end = min(due.size(), begin + REMINDER_BATCH_SIZE);
+		TRACE_SCOPE("Reminder::Render");
+		TRACE_ARG(end - begin);
+		//замеряется каждое построение в одной пачке из METRICS_SAMPLE
+		const bool timed = metrics::Sample();
+		for (size_t pos = begin; pos < end; ++pos) {
+			if (due[pos].connected != connected) {
+				Send(batch, connected);
+				connected = due[pos].connected;
+			}
+			const auto render_begin = timed ? chrono::steady_clock::now() : date::SteadyTimePoint();
+			Render(due[pos], m_job_views ? &(*m_job_views)[pos] : nullptr, message, batch);
+			if (timed)
+				metrics::Add(metrics::RENDER, metrics::Nanoseconds(render_begin));
+			changed += due[pos].changed;
+		}
+		Send(batch, connected);
+	}
+	m_job_changed += changed;
+}
+
+void Reminder::Send(Batch &batch, bool connected) {
+	if (batch.empty())
+		return;
+
+	if (m_stamped) {
+		int64_t enqueued = chrono::duration_cast<chrono::microseconds>(
+				chrono::system_clock::now().time_since_epoch()).count();
+		for (auto &msg : batch)
+			str::Append(msg.body, enqueued);
+	}
+
+	m_sender(batch, connected);
+	batch.clear();
+}
+
+void Reminder::Render(Due &user, LeaderBoard::View *view, string &message, Batch &batch) {
+	uint64_t fingerprint = user.fingerprint;
+	int64_t week = view ? view->week : 0;
+	bool send = true;
+	try {
+		if (view)
+			send = m_board.GetStatDelta(user.id, message, *view);
+		else if (m_unchanged == Unchanged::SEND)
+			m_board.GetStatMessage(user.id, message);
+		else
+			send = m_board.GetStatMessage(user.id, message, user.fingerprint);
+	} catch(const err::Error &e) {
+		message.clear();
+		Debug("Failed to get message. Error: " + string(e.what()));
+	}
+
+	if (!send) {
+		++m_unchanged_count;
+		auto kind = Producer::Message::DELTA;
+		if (m_unchanged == Unchanged::HEARTBEAT) {
+			message = "User (id:";
+			str::Append(message, user.id);
+			message += "): unchanged";
+			kind = Producer::Message::HEARTBEAT;
+		}
+		//в полном формате SEND сюда не попадает, в разностном уходит пустая разность
+		if (m_unchanged != Unchanged::SKIP) {
+			m_bytes += message.size();
+			batch.push_back(Producer::Message{user.id, kind, message});
+			StampMessage(user, batch.back().body);
+		}
+		return;
+	}
+
+	user.changed = user.fingerprint != fingerprint || view;
+	if (!message.empty()) {
+		++m_sent;
+		m_bytes += message.size();
+		//в разностном формате полное сообщение - только при смене недели View
+		bool full = !view || view->week != week;
+		batch.push_back(Producer::Message{user.id, full ? Producer::Message::FULL : Producer::Message::DELTA, message});
+		StampMessage(user, batch.back().body);
+	}
+}
+
+/*
+ * Штамп без времени постановки в очередь - его дописывает Send для всей пачки
+ */
+void Reminder::StampMessage(const Due &user, string &message) const {
+	if (!m_stamped)
+		return;
+
+	message += user.connected ? "\nStamp: c " : "\nStamp: p ";
+	str::Append(message, static_cast<int64_t>(user.token));
+	message += ' ';
+	str::Append(message, user.scheduled);
+	message += ' ';
+}
+
+/*
+ * Пул запускается первым заданием, а не в конструкторе: глобальный Reminder сервера создается
+ * при статической инициализации, когда глобальные объекты других единиц (трассировка) могут быть еще не готовы.
+ * Вызывающий Tick поток строит сообщения сам, пулу - остальные
+ */
+void Reminder::StartPool() {
+	for (int worker = 1; worker < m_pool_size; ++worker)
+		m_workers.emplace_back(&Reminder::Work, this);
+}
+
+void Reminder::Work() {
+	TRACE_THREAD("render");
+	uint64_t generation = 0;
+	while (true) {
+		{
+			unique_lock<mutex> cs(m_pool_mutex);
+			m_pool_start.wait(cs, [this, generation]() {
+				return m_pool_stopped || m_job_generation != generation;
+			});
+			if (m_pool_stopped)
+				return;
+			generation = m_job_generation;
+		}
+
+		RenderJob();
+
+		lock_guard<mutex> cs(m_pool_mutex);
+		if (--m_job_active == 0)
+			m_pool_done.notify_one();
+	}
+}
+
+void Reminder::Stop() {
+	{
+		lock_guard<mutex> cs(m_data_mutex);
+		m_stopped = true;
+	}
+	m_can_process.notify_one();
+}
+
+Reminder::Counters Reminder::GetCounters() const {
+	return Counters{m_sent, m_unchanged_count, m_bytes};
+}
+
+void Reminder::Report() {
+	auto counters = GetCounters();
+	Debug("Reminder: sent " + str::Str((int64_t)counters.sent) +
+			", unchanged " + str::Str((int64_t)counters.unchanged) +
+			", bytes " + str::Str((int64_t)counters.bytes));
+}
+
+int64_t Reminder::TickOf(const date::SteadyTimePoint &time) const {
+	if (time < m_start)
+		return 0;
+	return chrono::duration_cast<chrono::milliseconds>(time - m_start).count() / REMINDER_TICK_MS;
+}
+
+/*
+ * Начало ближайшего такта с непустым слотом
+ */
+date::SteadyTimePoint Reminder::NextWake() const {
+	for (int64_t tick = m_cursor; tick < m_cursor + REMINDER_SLOTS; ++tick) {
+		if (m_slots[tick % REMINDER_SLOTS] != NIL)
+			return m_start + chrono::milliseconds(tick * REMINDER_TICK_MS);
+	}
+
+	//какое-то время - разбудят раньше, если что
+	return chrono::steady_clock::now() + chrono::milliseconds(REMINDER_PERIOD_MS);
+}
+
+void Reminder::Link(uint32_t reminder, uint32_t slot) {
+	ReminderDesc &desc = m_reminders[reminder];
+	desc.slot = slot;
+	desc.prev = NIL;
+	desc.next = m_slots[slot];
+	if (desc.next != NIL)
+		m_reminders[desc.next].prev = reminder;
+	m_slots[slot] = reminder;
+}
+
+void Reminder::Unlink(uint32_t reminder) {
+	ReminderDesc &desc = m_reminders[reminder];
+	if (desc.prev != NIL)
+		m_reminders[desc.prev].next = desc.next;
+	else
+		m_slots[desc.slot] = desc.next;
+
+	if (desc.next != NIL)
+		m_reminders[desc.next].prev = desc.prev;
+}
+
+void Reminder::DebugContents() const {
+	Debug("Reminder contents:");
+
+	for (size_t slot = 0; slot < m_slots.size(); ++slot) {
+		for (uint32_t cur = m_slots[slot]; cur != NIL; cur = m_reminders[cur].next)
+			Debug("\t" + str::Str((int64_t)slot) + ": " + str::Str(m_reminders[cur].id));
+	}
+}
@@ -0,0 +1,208 @@
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <lb_error.h>
+#include <lb_ring.h>
+#include <lb_shm.h>
+
+using namespace std;
+
+namespace shm {
+namespace {
+const uint64_t MAGIC = 0x4C42524E47303031ull; //"LBRNG001"
+const uint64_t ALIGN = 16;
+//сколько ждать, пока создатель сегмента закончит его разметку
+const int OPEN_TIMEOUT_MS = 1000;
+
+uint64_t RoundUp(uint64_t size) {
+	return (size + ALIGN - 1) & ~(ALIGN - 1);
+}
+} //end of anonymous namespace
+
+struct Ring::Header {
+	atomic<uint64_t> magic;
+	uint64_t capacity;
+	//писатели и читатель не должны делить строку кэша
+	alignas(64) atomic<uint64_t> tail;
+	alignas(64) atomic<uint64_t> head;
+};
+
+struct Ring::Record {
+	atomic<uint64_t> ready;
+	uint32_t length;
+	uint32_t filler;
+};
+
+Ring::Ring(const string &name, size_t capacity)
+: m_header(nullptr)
+, m_data(nullptr)
+, m_mapped(0)
+, m_capacity(0)
+, m_read(0) {
+	static_assert(sizeof(Record) == ALIGN, "record header must keep bodies aligned");
+	static_assert(atomic<uint64_t>::is_always_lock_free, "shared memory needs address-free atomics");
+
+	//емкость - степень двойки, позиция в буфере берется маской
+	uint64_t size = ALIGN * 2;
+	while (size < capacity)
+		size <<= 1;
+
+	bool created = true;
+	int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0 && errno == EEXIST) {
+		created = false;
+		fd = shm_open(name.c_str(), O_RDWR, 0600);
+	}
+	if (fd < 0)
+		throw err::Error("failed", "shm_open", name);
+
+	if (created && ftruncate(fd, sizeof(Header) + size) != 0) {
+		close(fd);
+		shm_unlink(name.c_str());
+		throw err::Error("failed", "ftruncate", name);
+	}
+
+	//открывший вторым ждет, пока создатель задаст размер сегмента
+	ring::Backoff backoff;
+	struct stat info;
+	auto deadline = chrono::steady_clock::now() + chrono::milliseconds(OPEN_TIMEOUT_MS);
+	for ( ; ; backoff.Wait()) {
+		if (fstat(fd, &info) != 0) {
+			close(fd);
+			throw err::Error("failed", "stat", name);
+		}
+		if (static_cast<size_t>(info.st_size) > sizeof(Header))
+			break;
+		if (chrono::steady_clock::now() > deadline) {
+			close(fd);
+			throw err::Error("not ready", "shared memory", name);
+		}
+	}
+
+	m_mapped = static_cast<size_t>(info.st_size);
+	void *data = mmap(nullptr, m_mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		throw err::Error("failed", "mmap", name);
+
+	m_header = static_cast<Header *>(data);
+	m_data = static_cast<char *>(data) + sizeof(Header);
+
+	if (created) {
+		//ftruncate заполнил сегмент нулями - остается только разметка
+		m_header->capacity = size;
+		m_header->magic.store(MAGIC, memory_order_release);
+	} else {
+		for (backoff.Reset(); m_header->magic.load(memory_order_acquire) != MAGIC; backoff.Wait()) {
+			if (chrono::steady_clock::now() > deadline) {
+				munmap(data, m_mapped);
+				throw err::Error("not ready", "shared memory", name);
+			}
+		}
+		if (sizeof(Header) + m_header->capacity > m_mapped) {
+			munmap(data, m_mapped);
+			throw err::Error("corrupted", "shared memory", name);
+		}
+	}
+
+	m_capacity = m_header->capacity;
+	m_read = m_header->head.load(memory_order_acquire);
+}
+
+Ring::~Ring() {
+	munmap(m_header, m_mapped);
+}
+
+/*
+ * Возвращает false, если места нет. Можно звать из любого числа потоков и процессов
+ */
+bool Ring::TryWrite(string_view body) {
+	const uint64_t size = RoundUp(sizeof(Record) + body.size());
+	if (size > m_capacity / 2)
+		throw err::Error("too long", "message", string(body.substr(0, 32)));
+
+	uint64_t tail = m_header->tail.load(memory_order_relaxed);
+	uint64_t gap = 0;
+	do {
+		//запись не разрывается на краю буфера, остаток до края - заполнитель
+		uint64_t offset = tail & (m_capacity - 1);
+		gap = offset + size > m_capacity ? m_capacity - offset : 0;
+		if (tail + gap + size - m_header->head.load(memory_order_acquire) > m_capacity)
+			return false;
+	} while (!m_header->tail.compare_exchange_weak(tail, tail + gap + size,
+			memory_order_relaxed, memory_order_relaxed));
+
+	if (gap) {
+		Record *filler = At(tail);
+		filler->length = 0;
+		filler->filler = 1;
+		filler->ready.store(tail + 1, memory_order_release);
+	}
+
+	//отсюда до отметки готовности падение писателя останавливает читателя на этой записи (см. lb_shm.h)
+	const uint64_t pos = tail + gap;
+	Record *record = At(pos);
+	record->length = static_cast<uint32_t>(body.size());
+	record->filler = 0;
+	memcpy(reinterpret_cast<char *>(record + 1), body.data(), body.size());
+	record->ready.store(pos + 1, memory_order_release);
+	return true;
+}
+
+void Ring::Write(string_view body) {
+	ring::Backoff backoff;
+	while (!TryWrite(body))
+		backoff.Wait();
+}
+
+/*
+ * Только для единственного читателя. Возвращает false, если готовых записей нет.
+ * body действительно до Release за ним, end - позиция для Release после обработки записи
+ */
+bool Ring::Read(string_view &body, uint64_t &end) {
+	for ( ; ; ) {
+		//неготовая запись - еще пишется или ее писатель умер; различить нельзя, поэтому только ждать
+		Record *record = At(m_read);
+		if (record->ready.load(memory_order_acquire) != m_read + 1)
+			return false;
+
+		if (record->filler) {
+			m_read += m_capacity - (m_read & (m_capacity - 1));
+			continue;
+		}
+
+		body = string_view(reinterpret_cast<const char *>(record + 1), record->length);
+		m_read += RoundUp(sizeof(Record) + record->length);
+		end = m_read;
+		return true;
+	}
+}
+
+/*
+ * Освобождает место всех записей до end для писателей
+ */
+void Ring::Release(uint64_t end) {
+	m_header->head.store(end, memory_order_release);
+}
+
+size_t Ring::Capacity() const {
+	return m_capacity;
+}
+
+size_t Ring::Size() const {
+	return m_header->tail.load(memory_order_acquire) - m_header->head.load(memory_order_acquire);
+}
+
+void Ring::Remove(const string &name) {
+	shm_unlink(name.c_str());
+}
+
+Ring::Record *Ring::At(uint64_t pos) const {
+	return reinterpret_cast<Record *>(m_data + (pos & (m_capacity - 1)));
+}
+} //end of shm namespace
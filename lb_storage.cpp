@@ -0,0 +1,334 @@
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <lb_defines.h>
+#include <lb_error.h>
+#include <lb_storage.h>
+
+using namespace std;
+
+namespace {
+const string SNAPSHOT_MAGIC = "LBSNAP02";
+
+/*
+ * Контрольная сумма снимка (FNV-1a) - дописывается в конец и проверяется до разбора образа
+ */
+uint64_t Checksum(string_view data) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (unsigned char c : data) {
+		hash ^= c;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+//тип записи журнала с пачкой выигрышей, остальные записи - по cmd::Type
+const uint8_t RECORD_WINS = 0xFF;
+
+/*
+ * Отображает файл в память на время вызова func. Возвращает false, если файла нет
+ */
+bool MapFile(const string &path, const function<void(string_view)> &func) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return false;
+		throw err::Error("failed", "open", path);
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		close(fd);
+		throw err::Error("failed", "stat", path);
+	}
+
+	size_t size = static_cast<size_t>(info.st_size);
+	if (size == 0) {
+		close(fd);
+		func(string_view());
+		return true;
+	}
+
+	void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		throw err::Error("failed", "mmap", path);
+	madvise(data, size, MADV_SEQUENTIAL);
+
+	try {
+		func(string_view(static_cast<const char *>(data), size));
+	} catch (...) {
+		munmap(data, size);
+		throw;
+	}
+	munmap(data, size);
+	return true;
+}
+
+double MsSince(const chrono::steady_clock::time_point &start) {
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+} //end of anonymous namespace
+
+Storage::Storage(const string &dir)
+: m_dir(dir)
+, m_generation(0)
+, m_journal(nullptr)
+, m_snapshot_time(chrono::steady_clock::now())
+, m_writing(false) {
+	if (mkdir(m_dir.c_str(), 0755) != 0 && errno != EEXIST)
+		throw err::Error("failed", "mkdir", m_dir);
+}
+
+Storage::~Storage() {
+	if (m_writer.joinable())
+		m_writer.join();
+
+	if (m_journal) {
+		fflush(m_journal);
+		fclose(m_journal);
+	}
+}
+
+/*
+ * Вызывается при старте, до запуска приема сообщений
+ */
+void Storage::Restore(LeaderBoard &board, Reminder &reminder, const Replayer &replay) {
+	auto start = chrono::steady_clock::now();
+	uint64_t generation = LoadSnapshot(board, reminder);
+	double snapshot_ms = MsSince(start);
+
+	uint64_t journals = 0;
+	while (ReplayJournal(generation, board, replay)) {
+		++generation;
+		++journals;
+	}
+
+	m_generation = generation;
+	OpenJournal();
+
+	Debug("Restored in " + str::Str(MsSince(start), 1) + " ms: snapshot " + str::Str(snapshot_ms, 1) +
+			" ms, journals replayed " + str::Str((int64_t)journals));
+}
+
+/*
+ * Запись: размер, тип, id и поля команды
+ */
+void Storage::Append(const cmd::Command &command) {
+	m_record.clear();
+	bin::Put(m_record, uint32_t(0));
+	bin::Put(m_record, static_cast<uint8_t>(command.type));
+	bin::Put(m_record, command.id);
+
+	switch (command.type) {
+	case cmd::USER_REGISTER:
+	case cmd::USER_RENAME:
+		m_record += command.name;
+		break;
+	case cmd::USER_WON:
+		bin::Put(m_record, static_cast<int64_t>(command.date.time_since_epoch().count()));
+		bin::Put(m_record, command.amount);
+		break;
+	case cmd::USER_CONNECT:
+	case cmd::USER_DISCONNECT:
+		break;
+	}
+
+	WriteRecord();
+}
+
+/*
+ * Запись: размер, тип и выигрыши пачки в исходном порядке
+ */
+void Storage::Append(const vector<LeaderBoard::Win> &wins) {
+	m_record.clear();
+	bin::Put(m_record, uint32_t(0));
+	bin::Put(m_record, RECORD_WINS);
+	for (auto &win : wins) {
+		bin::Put(m_record, win.id);
+		bin::Put(m_record, static_cast<int64_t>(win.date.time_since_epoch().count()));
+		bin::Put(m_record, win.amount);
+	}
+
+	WriteRecord();
+}
+
+/*
+ * Вызывается перед подтверждением сообщений брокеру
+ */
+void Storage::Flush() {
+	if (fflush(m_journal) != 0)
+		throw err::Error("failed", "journal", JournalPath(m_generation));
+	if (STORAGE_SYNC && fdatasync(fileno(m_journal)) != 0)
+		throw err::Error("failed", "journal", JournalPath(m_generation));
+}
+
+bool Storage::SnapshotDue() const {
+	return !m_writing && chrono::steady_clock::now() - m_snapshot_time >= chrono::seconds(STORAGE_SNAPSHOT_SEC);
+}
+
+/*
+ * Вызывается потоком применения между командами, когда все примененное записано в журнал
+ */
+void Storage::Snapshot(LeaderBoard &board, Reminder &reminder) {
+	if (m_writer.joinable())
+		m_writer.join();
+
+	auto start = chrono::steady_clock::now();
+	m_snapshot_time = start;
+
+	string image = SNAPSHOT_MAGIC;
+	bin::Put(image, m_generation + 1);
+	board.Save(image);
+	reminder.Save(image);
+
+	Flush();
+	fclose(m_journal);
+	++m_generation;
+	OpenJournal();
+
+	Debug("Snapshot " + str::Str((int64_t)m_generation) + " taken in " + str::Str(MsSince(start), 1) +
+			" ms, " + str::Str((int64_t)image.size()) + " bytes");
+
+	m_writing = true;
+	m_writer = thread(&Storage::WriteSnapshot, this, move(image), m_generation);
+}
+
+void Storage::WriteRecord() {
+	uint32_t size = static_cast<uint32_t>(m_record.size() - sizeof(uint32_t));
+	memcpy(&m_record[0], &size, sizeof(size));
+
+	if (fwrite(m_record.data(), 1, m_record.size(), m_journal) != m_record.size())
+		throw err::Error("failed", "journal", JournalPath(m_generation));
+}
+
+string Storage::JournalPath(uint64_t generation) const {
+	return m_dir + "/journal." + str::Str((int64_t)generation);
+}
+
+string Storage::SnapshotPath() const {
+	return m_dir + "/snapshot";
+}
+
+/*
+ * Возвращает номер журнала, с которого продолжать, 0 - если снимка нет
+ */
+uint64_t Storage::LoadSnapshot(LeaderBoard &board, Reminder &reminder) {
+	uint64_t generation = 0;
+	MapFile(SnapshotPath(), [&](string_view image) {
+		if (image.substr(0, SNAPSHOT_MAGIC.size()) != SNAPSHOT_MAGIC)
+			throw err::Error("corrupted", "snapshot", "magic");
+		image.remove_prefix(SNAPSHOT_MAGIC.size());
+
+		uint64_t checksum = 0;
+		string_view tail = image.substr(image.size() - min(image.size(), sizeof(checksum)));
+		image.remove_suffix(tail.size());
+		if (!bin::Get(tail, checksum) || checksum != Checksum(image))
+			throw err::Error("corrupted", "snapshot", "checksum");
+
+		if (!bin::Get(image, generation))
+			throw err::Error("corrupted", "snapshot", "generation");
+
+		board.Load(image);
+		reminder.Load(image);
+	});
+	return generation;
+}
+
+/*
+ * Недописанная последняя запись (падение посреди записи) отбрасывается
+ */
+bool Storage::ReplayJournal(uint64_t generation, LeaderBoard &board, const Replayer &replay) {
+	const string path = JournalPath(generation);
+	return MapFile(path, [&](string_view journal) {
+		cmd::Command command;
+		command.token = 0;
+		vector<LeaderBoard::Win> wins;
+		int64_t records = 0;
+		while (!journal.empty()) {
+			uint32_t size = 0;
+			uint8_t type = 0;
+			if (!bin::Get(journal, size) || journal.size() < size) {
+				Debug("Journal " + path + " truncated after " + str::Str(records) + " records");
+				return;
+			}
+
+			string_view record = journal.substr(0, size);
+			journal.remove_prefix(size);
+			++records;
+
+			if (!bin::Get(record, type))
+				throw err::Error("corrupted", "journal", path);
+
+			if (type == RECORD_WINS) {
+				wins.clear();
+				while (!record.empty()) {
+					LeaderBoard::Win win;
+					int64_t date = 0;
+					if (!bin::Get(record, win.id) || !bin::Get(record, date) || !bin::Get(record, win.amount))
+						throw err::Error("corrupted", "journal", path);
+					win.date = date::SystemTimePoint(date::SystemTimePoint::duration(date));
+					wins.push_back(win);
+				}
+				board.AddWins(wins);
+				continue;
+			}
+
+			if (!bin::Get(record, command.id))
+				throw err::Error("corrupted", "journal", path);
+			command.type = static_cast<cmd::Type>(type);
+
+			if (command.type == cmd::USER_REGISTER || command.type == cmd::USER_RENAME) {
+				command.name = record;
+			} else if (command.type == cmd::USER_WON) {
+				int64_t date = 0;
+				if (!bin::Get(record, date) || !bin::Get(record, command.amount))
+					throw err::Error("corrupted", "journal", path);
+				command.date = date::SystemTimePoint(date::SystemTimePoint::duration(date));
+			} else if (command.type != cmd::USER_CONNECT && command.type != cmd::USER_DISCONNECT)
+				throw err::Error("corrupted", "journal", path);
+
+			replay(command);
+		}
+	});
+}
+
+void Storage::OpenJournal() {
+	m_journal = fopen(JournalPath(m_generation).c_str(), "ab");
+	if (!m_journal)
+		throw err::Error("failed", "journal", JournalPath(m_generation));
+	setvbuf(m_journal, nullptr, _IOFBF, 1 << 20);
+}
+
+/*
+ * Фоновая запись: сначала во временный файл, потом переименование - снимок на диске всегда целый
+ */
+void Storage::WriteSnapshot(string image, uint64_t generation) {
+	const string tmp_path = SnapshotPath() + ".tmp";
+	try {
+		//сумма считается здесь, чтобы не задерживать поток применения
+		bin::Put(image, Checksum(string_view(image).substr(SNAPSHOT_MAGIC.size())));
+
+		FILE *file = fopen(tmp_path.c_str(), "wb");
+		if (!file)
+			throw err::Error("failed", "snapshot", tmp_path);
+
+		bool written = fwrite(image.data(), 1, image.size(), file) == image.size() &&
+				fflush(file) == 0 && fsync(fileno(file)) == 0;
+		fclose(file);
+		if (!written || rename(tmp_path.c_str(), SnapshotPath().c_str()) != 0)
+			throw err::Error("failed", "snapshot", tmp_path);
+
+		//журналы до снимка больше не нужны
+		for (uint64_t old = generation; old > 0 && remove(JournalPath(old - 1).c_str()) == 0; --old)
+			;
+	} catch(const err::Error& e) {
+		Debug("Failed to write snapshot: " + string(e.what()));
+	}
+
+	m_writing = false;
+}
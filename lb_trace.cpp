@@ -0,0 +1,156 @@
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <unistd.h>
+#include <vector>
+
+#include <lb_defines.h>
+#include <lb_error.h>
+#include <lb_functions.h>
+#include <lb_trace.h>
+
+using namespace std;
+
+namespace trace {
+namespace {
+static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0, "TRACE_RING_SIZE must be a power of two");
+
+//поля атомарны, чтобы Dump мог читать кольцо во время записи
+struct Event {
+	atomic<const char *> name;
+	atomic<int64_t> begin;
+	atomic<int64_t> end;
+	atomic<int64_t> arg;
+};
+
+struct Copy {
+	const char *name;
+	int64_t begin;
+	int64_t end;
+	int64_t arg;
+};
+
+/*
+ * Кольцо одного потока: пишет только он, head - число записанных событий
+ */
+struct Ring {
+	unique_ptr<Event[]> events;
+	atomic<uint64_t> head;
+	int64_t tid;
+	string name;
+
+	explicit Ring(int64_t thread_id)
+	: events(new Event[TRACE_RING_SIZE])
+	, head(0)
+	, tid(thread_id) {}
+};
+
+//кольца завершившихся потоков остаются - их события тоже попадают в Dump
+mutex rings_mutex;
+vector<unique_ptr<Ring>> rings;
+
+thread_local Ring *local = nullptr;
+
+Ring &Local() {
+	if (!local) {
+		lock_guard<mutex> cs(rings_mutex);
+		rings.emplace_back(new Ring(static_cast<int64_t>(rings.size()) + 1));
+		local = rings.back().get();
+	}
+	return *local;
+}
+
+/*
+ * Событие, перезаписанное во время копирования, отбрасывается: после копии
+ * действительны только те, что не старше head - TRACE_RING_SIZE + 1 (следующее может писаться сейчас)
+ */
+void CopyRing(const Ring &ring, vector<Copy> &events) {
+	uint64_t head = ring.head.load(memory_order_acquire);
+	uint64_t from = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+
+	events.clear();
+	for (uint64_t pos = from; pos < head; ++pos) {
+		const Event &event = ring.events[pos & (TRACE_RING_SIZE - 1)];
+		events.push_back(Copy{event.name.load(memory_order_relaxed), event.begin.load(memory_order_relaxed),
+				event.end.load(memory_order_relaxed), event.arg.load(memory_order_relaxed)});
+	}
+
+	atomic_thread_fence(memory_order_acquire);
+	uint64_t after = ring.head.load(memory_order_relaxed);
+	if (after + 1 > from + TRACE_RING_SIZE)
+		events.erase(events.begin(), events.begin() + min<uint64_t>(events.size(), after + 1 - TRACE_RING_SIZE - from));
+}
+
+//микросекунды с дробной частью - единица времени формата
+string Micros(int64_t ns) {
+	return str::Str(ns / 1000.0, 3);
+}
+} //end of anonymous namespace
+
+void Record(const char *name, int64_t begin, int64_t end, int64_t arg) {
+	Ring &ring = Local();
+	uint64_t pos = ring.head.load(memory_order_relaxed);
+	//прошлый head виден раньше, чем новые поля, - для проверки в CopyRing
+	atomic_thread_fence(memory_order_release);
+	Event &event = ring.events[pos & (TRACE_RING_SIZE - 1)];
+	event.name.store(name, memory_order_relaxed);
+	event.begin.store(begin, memory_order_relaxed);
+	event.end.store(end, memory_order_relaxed);
+	event.arg.store(arg, memory_order_relaxed);
+	ring.head.store(pos + 1, memory_order_release);
+}
+
+void NameThread(const char *name) {
+	Ring &ring = Local();
+	lock_guard<mutex> cs(rings_mutex);
+	ring.name = name;
+}
+
+/*
+ * Объект {"traceEvents": [...]}: имена потоков - события "M", блоки - "X" с длительностью
+ */
+void Dump(const string &path) {
+	const string pid = str::Str(static_cast<int64_t>(getpid()));
+	string json = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+	bool first = true;
+	auto next = [&json, &first]() {
+		json += first ? "\n" : ",\n";
+		first = false;
+	};
+
+	vector<Copy> events;
+	{
+		lock_guard<mutex> cs(rings_mutex);
+		for (auto &ring : rings) {
+			const string tid = str::Str(ring->tid);
+			if (!ring->name.empty()) {
+				next();
+				json += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + pid + ",\"tid\":" + tid +
+						",\"args\":{\"name\":\"" + ring->name + "\"}}";
+			}
+
+			CopyRing(*ring, events);
+			for (auto &event : events) {
+				next();
+				json += "{\"name\":\"";
+				json += event.name;
+				json += "\",\"ph\":\"X\",\"pid\":" + pid + ",\"tid\":" + tid +
+						",\"ts\":" + Micros(event.begin) + ",\"dur\":" + Micros(event.end - event.begin) +
+						",\"args\":{\"arg\":" + str::Str(event.arg) + "}}";
+			}
+		}
+	}
+	json += "\n]}\n";
+
+	const string tmp_path = path + ".tmp";
+	FILE *file = fopen(tmp_path.c_str(), "wb");
+	if (!file)
+		throw err::Error("failed", "trace", tmp_path);
+
+	bool written = fwrite(json.data(), 1, json.size(), file) == json.size();
+	written = fclose(file) == 0 && written;
+	if (!written || rename(tmp_path.c_str(), path.c_str()) != 0)
+		throw err::Error("failed", "trace", tmp_path);
+}
+} //end of trace namespace
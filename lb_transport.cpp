@@ -0,0 +1,167 @@
+#include <chrono>
+#include <cstring>
+#include <SimpleAmqpClient/SimpleAmqpClient.h>
+
+#include <lb_error.h>
+#include <lb_ring.h>
+#include <lb_shm.h>
+#include <lb_transport.h>
+
+using namespace std;
+using namespace AmqpClient;
+
+namespace transport {
+namespace {
+const string OPTION = "--transport=";
+
+class AmqpSender : public Sender {
+public:
+	explicit AmqpSender(const string &queue)
+	: m_channel(Channel::Create(RABBITMQ_HOST))
+	, m_route(queue) {
+		m_channel->DeclareQueue(queue, false, false, false, false);
+	}
+
+	//точка обмена по умолчанию направляет сообщение в очередь с именем ключа маршрута
+	void Publish(string_view body) override {
+		m_channel->BasicPublish("", m_route, BasicMessage::Create(string(body)));
+	}
+private:
+	Channel::ptr_t m_channel;
+	string m_route;
+};
+
+/*
+ * prefetch <= 0 - брокер считает сообщение доставленным сразу, Ack не нужен
+ */
+class AmqpReceiver : public Receiver {
+public:
+	AmqpReceiver(const string &queue, int prefetch)
+	: m_channel(Channel::Create(RABBITMQ_HOST))
+	, m_delivery_channel(0) {
+		m_channel->DeclareQueue(queue, false, false, false, false);
+		if (prefetch > 0)
+			m_consumer = m_channel->BasicConsume(queue, "", true, false, true, prefetch);
+		else
+			m_consumer = m_channel->BasicConsume(queue, "", true, true);
+	}
+
+	bool Receive(Delivery &delivery, int timeout_ms) override {
+		Envelope::ptr_t env;
+		if (timeout_ms < 0)
+			env = m_channel->BasicConsumeMessage(m_consumer);
+		else if (!m_channel->BasicConsumeMessage(m_consumer, env, timeout_ms))
+			return false;
+
+		//тело разбирается прямо из буфера сообщения - конверт живет, пока жив owner
+		delivery.owner = shared_ptr<const void>(env.get(), [env](const void *) {});
+		delivery.body = env->Message()->Body();
+		delivery.tag = env->GetDeliveryInfo().delivery_tag;
+		m_delivery_channel = env->GetDeliveryInfo().delivery_channel;
+		return true;
+	}
+
+	void Ack(uint64_t tag) override {
+		Envelope::DeliveryInfo info;
+		info.delivery_tag = tag;
+		info.delivery_channel = m_delivery_channel;
+		m_channel->BasicAck(info, true);
+	}
+private:
+	Channel::ptr_t m_channel;
+	string m_consumer;
+	uint16_t m_delivery_channel;
+};
+
+class ShmSender : public Sender {
+public:
+	explicit ShmSender(const string &queue)
+	: m_ring("/" + queue, SHM_RING_SIZE) {}
+
+	//при заполненном кольце ждет читателя, как ждал бы брокер с переполненной очередью
+	void Publish(string_view body) override {
+		m_ring.Write(body);
+	}
+private:
+	shm::Ring m_ring;
+};
+
+/*
+ * Тег - конец записи в кольце, Ack освобождает место до него.
+ * prefetch <= 0 - место освобождается следующим Receive, Ack не нужен
+ */
+class ShmReceiver : public Receiver {
+public:
+	ShmReceiver(const string &queue, int prefetch)
+	: m_ring("/" + queue, SHM_RING_SIZE)
+	, m_auto_ack(prefetch <= 0)
+	, m_received(0) {}
+
+	bool Receive(Delivery &delivery, int timeout_ms) override {
+		if (m_auto_ack && m_received)
+			m_ring.Release(m_received);
+
+		ring::Backoff backoff;
+		auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+		while (!m_ring.Read(delivery.body, delivery.tag)) {
+			if (timeout_ms >= 0 && chrono::steady_clock::now() >= deadline)
+				return false;
+			backoff.Wait();
+		}
+
+		delivery.owner.reset();
+		m_received = delivery.tag;
+		return true;
+	}
+
+	void Ack(uint64_t tag) override {
+		m_ring.Release(tag);
+	}
+private:
+	shm::Ring m_ring;
+	bool m_auto_ack;
+	uint64_t m_received;
+};
+} //end of anonymous namespace
+
+unique_ptr<Sender> OpenSender(Transport kind, const string &queue) {
+	if (kind == Transport::SHM)
+		return unique_ptr<Sender>(new ShmSender(queue));
+	return unique_ptr<Sender>(new AmqpSender(queue));
+}
+
+unique_ptr<Receiver> OpenReceiver(Transport kind, const string &queue, int prefetch) {
+	if (kind == Transport::SHM)
+		return unique_ptr<Receiver>(new ShmReceiver(queue, prefetch));
+	return unique_ptr<Receiver>(new AmqpReceiver(queue, prefetch));
+}
+
+bool Parse(const string &name, Transport &kind) {
+	if (name == "amqp")
+		kind = Transport::AMQP;
+	else if (name == "shm")
+		kind = Transport::SHM;
+	else
+		return false;
+	return true;
+}
+
+/*
+ * Первый аргумент "--transport=amqp|shm" выбирает способ доставки и убирается из аргументов,
+ * без него - LB_TRANSPORT
+ */
+Transport Select(int &argc, char *argv[]) {
+	Transport kind = LB_TRANSPORT;
+	if (argc < 2 || strncmp(argv[1], OPTION.c_str(), OPTION.size()) != 0)
+		return kind;
+
+	const string name = argv[1] + OPTION.size();
+	if (!Parse(name, kind))
+		throw err::Error("unknown", "transport", name);
+
+	for (int arg = 1; arg + 1 < argc; ++arg)
+		argv[arg] = argv[arg + 1];
+	--argc;
+	return kind;
+}
+} //end of transport namespace
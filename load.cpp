@@ -1,43 +1,377 @@
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <iostream>
-#include <SimpleAmqpClient/SimpleAmqpClient.h>
+#include <random>
+#include <thread>
+#include <vector>
 
 #include <lb_defines.h>
+#include <lb_error.h>
 #include <lb_functions.h>
+#include <lb_histogram.h>
+#include <lb_transport.h>
 
 using namespace std;
-using namespace AmqpClient;
 
-int main() {
+enum MessageType { REGISTER, RENAME, WON, CONNECT, DISCONNECT, TYPES };
+
+const string TYPE_NAMES[TYPES] = {"register", "rename", "won", "connect", "disconnect"};
+const string TYPE_MESSAGES[TYPES] = {MSG_USER_REGISTER, MSG_USER_RENAME, MSG_USER_WON, MSG_USER_CONNECT, MSG_USER_DISCONNECT};
+
+struct Options {
+	Transport transport = LB_TRANSPORT;
+	int64_t users = 1000;
+	int64_t rate = 1000;
+	int64_t duration = 10;
+	int64_t threads = 1;
+	int64_t pool = 1 << 20;
+	bool setup = true;
+	bool token = false;
+	int64_t mix[TYPES] = {0, 2, 90, 4, 4};
+};
+
+void PrintUsage() {
+	cout << "Usage:" << endl;
+	cout << "load [OPTIONS]" << endl;
+	cout << "[OPTIONS] could be:" << endl;
+	cout << "\t--transport=amqp|shm - message channel (default amqp)" << endl;
+	cout << "\t--users=N - registered users 1..N the messages refer to (default 1000)" << endl;
+	cout << "\t--rate=N - target messages per second over all threads (default 1000)" << endl;
+	cout << "\t--duration=N - run time in seconds (default 10)" << endl;
+	cout << "\t--threads=N - sending threads, each with its own connection (default 1)" << endl;
+	cout << "\t--mix=TYPE:WEIGHT,... - message mix over register, rename, won, connect, disconnect"
+			" (default register:0,rename:2,won:90,connect:4,disconnect:4)" << endl;
+	cout << "\t--pool=N - pre-encoded messages per thread, repeated when the run is longer (default 1048576)" << endl;
+	cout << "\t--setup=0|1 - register users 1..N before the run (default 1)" << endl;
+	cout << "\t--token=0|1 - tag wins and connects with their scheduled send time for monitor (default 0)" << endl;
+}
+
+bool ParseMix(string_view value, int64_t mix[TYPES]) {
+	fill(mix, mix + TYPES, 0);
+	while (!value.empty()) {
+		string_view item = str::NextWord(value, ',');
+		string_view name = str::NextWord(item, ':');
+
+		int type = 0;
+		while (type < TYPES && TYPE_NAMES[type] != name)
+			++type;
+		if (type == TYPES || !str::ToInt64(item, mix[type]) || mix[type] < 0)
+			return false;
+	}
+	return any_of(mix, mix + TYPES, [](int64_t weight) { return weight > 0; });
+}
+
+bool ParseOptions(int argc, char *argv[], Options &options) {
+	for (int arg = 1; arg < argc; ++arg) {
+		string_view option(argv[arg]);
+		if (option.substr(0, 2) != "--" || option.find('=') == string_view::npos)
+			return false;
+		option.remove_prefix(2);
+		string_view name = str::NextWord(option, '=');
+
+		int64_t number = 0;
+		if (name == "transport") {
+			if (!transport::Parse(string(option), options.transport))
+				return false;
+		} else if (name == "mix") {
+			if (!ParseMix(option, options.mix))
+				return false;
+		} else if (!str::ToInt64(option, number) || number < 0) {
+			return false;
+		} else if (name == "users") {
+			options.users = number;
+		} else if (name == "rate") {
+			options.rate = number;
+		} else if (name == "duration") {
+			options.duration = number;
+		} else if (name == "threads") {
+			options.threads = number;
+		} else if (name == "pool") {
+			options.pool = number;
+		} else if (name == "setup") {
+			options.setup = number != 0;
+		} else if (name == "token") {
+			options.token = number != 0;
+		} else {
+			return false;
+		}
+	}
+	return options.users > 0 && options.rate > 0 && options.threads > 0 && options.pool > 0;
+}
+
+/*
+ * Сообщения потока, построенные до начала отправки: одним буфером, по смещениям концов
+ *
+ * Подключения и отключения - только для своих пользователей потока (id по модулю числа потоков),
+ * так что у разных потоков они не пересекаются и всегда допустимы: подключается отключенный,
+ * отключается подключенный. Пул заканчивается отключением всех подключенных - его можно повторять.
+ * Регистрации - новые id за пределами users; при повторе пула сервер отклонит их как повторные
+ *
+ * С --token выигрыши и подключения заканчиваются строкой MSG_TOKEN с местом под TOKEN_DIGITS цифр,
+ * которое заполняется временем по расписанию прямо перед отправкой
+ */
+class Pool {
+public:
+	//мкс system_clock - 16 цифр
+	static const size_t TOKEN_DIGITS = 16;
+
+	Pool(const Options &options, int64_t thread, int64_t count) {
+		mt19937_64 random(thread + 1);
+		discrete_distribution<int> type_dist(options.mix, options.mix + TYPES);
+		uniform_int_distribution<int64_t> user_dist(1, options.users);
+		uniform_int_distribution<int64_t> amount_dist(1, 1000);
+		const string today = date::Format(chrono::system_clock::now());
+
+		vector<int64_t> offline;
+		vector<int64_t> online;
+		for (int64_t id = thread + 1; id <= options.users; id += options.threads)
+			offline.push_back(id);
+		int64_t registered = options.users + thread + 1;
+
+		auto pick = [&random](vector<int64_t> &from, vector<int64_t> &to) {
+			size_t index = uniform_int_distribution<size_t>(0, from.size() - 1)(random);
+			int64_t id = from[index];
+			from[index] = from.back();
+			from.pop_back();
+			to.push_back(id);
+			return id;
+		};
+
+		m_data.reserve(count * 48);
+		m_ends.reserve(count);
+		m_types.reserve(count);
+		for (int64_t cnt = 0; cnt < count; ++cnt) {
+			int type = type_dist(random);
+			if (type == CONNECT && offline.empty())
+				type = online.empty() ? WON : DISCONNECT;
+			else if (type == DISCONNECT && online.empty())
+				type = offline.empty() ? WON : CONNECT;
+
+			switch (type) {
+			case REGISTER:
+				Begin(REGISTER, registered);
+				m_data += "user";
+				str::Append(m_data, registered);
+				registered += options.threads;
+				break;
+			case RENAME: {
+				int64_t id = user_dist(random);
+				Begin(RENAME, id);
+				m_data += "name";
+				str::Append(m_data, cnt);
+				break;
+			}
+			case WON:
+				Begin(WON, user_dist(random));
+				m_data += today;
+				m_data += '\n';
+				str::Append(m_data, amount_dist(random));
+				if (options.token)
+					AddToken();
+				break;
+			case CONNECT:
+				Begin(CONNECT, pick(offline, online));
+				m_data.pop_back();
+				if (options.token)
+					AddToken();
+				break;
+			case DISCONNECT:
+				Begin(DISCONNECT, pick(online, offline));
+				m_data.pop_back();
+				break;
+			}
+			m_ends.push_back(m_data.size());
+			if (m_tokens.size() < m_ends.size())
+				m_tokens.push_back(0);
+		}
+
+		while (!online.empty()) {
+			Begin(DISCONNECT, pick(online, offline));
+			m_data.pop_back();
+			m_ends.push_back(m_data.size());
+			m_tokens.push_back(0);
+		}
+	}
+
+	string_view Get(size_t index) const {
+		size_t begin = index ? m_ends[index - 1] : 0;
+		return string_view(m_data).substr(begin, m_ends[index] - begin);
+	}
+
+	//записывает метку в место под нее, если у сообщения оно есть
+	void SetToken(size_t index, int64_t token) {
+		if (!m_tokens[index])
+			return;
+
+		char *digit = &m_data[m_ends[index]];
+		for (size_t cnt = 0; cnt < TOKEN_DIGITS; ++cnt, token /= 10)
+			*--digit = static_cast<char>('0' + token % 10);
+	}
+
+	int Type(size_t index) const {
+		return m_types[index];
+	}
+
+	size_t Size() const {
+		return m_ends.size();
+	}
+
+	size_t Bytes() const {
+		return m_data.size();
+	}
+private:
+	string m_data;
+	vector<size_t> m_ends;
+	vector<uint8_t> m_types;
+	//есть ли у сообщения место под метку (в конце)
+	vector<uint8_t> m_tokens;
+
+	//тип и id - первые строки любого сообщения
+	void Begin(int type, int64_t id) {
+		m_types.push_back(static_cast<uint8_t>(type));
+		m_data += TYPE_MESSAGES[type];
+		m_data += '\n';
+		str::Append(m_data, id);
+		m_data += '\n';
+	}
+
+	void AddToken() {
+		m_data += '\n';
+		m_data += MSG_TOKEN;
+		m_data.append(TOKEN_DIGITS, '0');
+		m_tokens.push_back(1);
+	}
+};
+
+/*
+ * Счетчики потока отправки. sent читает поток отчета, остальное - только после завершения
+ */
+struct Stats {
+	atomic<int64_t> sent;
+	int64_t types[TYPES];
+	hist::Histogram lag;
+	Stats() : sent(0), types() {}
+};
+
+/*
+ * Открытый цикл: сообщение k потока thread запланировано на start + (k * threads + thread) / rate
+ * независимо от того, когда ушли предыдущие. Отставший поток не пропускает сообщения и не сдвигает
+ * расписание, а отправляет их сразу - отставание от расписания попадает в lag, а не теряется.
+ * Метка - тоже время по расписанию, так что задержка в monitor включает и отставание отправки
+ */
+void Send(const Options &options, int64_t thread, Pool &pool,
+		const chrono::steady_clock::time_point &start, const int64_t system_start_us, Stats &stats) {
+	auto output = transport::OpenSender(options.transport, LB_INPUT_QUEUE);
+	const auto end = start + chrono::seconds(options.duration);
+	const double step = 1e9 / options.rate;
+
+	for (int64_t cnt = 0; ; ++cnt) {
+		auto scheduled = start + chrono::nanoseconds(static_cast<int64_t>((cnt * options.threads + thread) * step));
+		if (scheduled >= end)
+			break;
+
+		auto now = chrono::steady_clock::now();
+		if (now < scheduled) {
+			this_thread::sleep_until(scheduled);
+			now = chrono::steady_clock::now();
+		}
+		stats.lag.Add(chrono::duration_cast<chrono::nanoseconds>(now - scheduled).count());
+
+		size_t index = cnt % pool.Size();
+		pool.SetToken(index, system_start_us + static_cast<int64_t>((cnt * options.threads + thread) * step / 1000));
+		output->Publish(pool.Get(index));
+		++stats.types[pool.Type(index)];
+		stats.sent.store(cnt + 1, memory_order_relaxed);
+	}
+}
+
+int main(int argc, char *argv[]) {
 	try {
-		int64_t load = 1000;
-
-		Channel::ptr_t connection(Channel::Create(RABBITMQ_HOST));
-		connection->DeclareQueue(LB_INPUT_QUEUE, false, false, false, false);
-
-		for (int64_t cnt = 1; cnt <= load; ++cnt) {
-			const string id = str::Str(cnt);
-			connection->BasicPublish("", LB_INPUT_ROUTE,
-				BasicMessage::Create(
-						MSG_USER_REGISTER +
-						"\n" + id +
-						"\nuser" + id
-				)
-			);
-		}
-
-		for (int64_t cnt = 1; cnt <= load; ++cnt) {
-			const string id = str::Str(cnt);
-			connection->BasicPublish("", LB_INPUT_ROUTE,
-				BasicMessage::Create(
-						MSG_USER_WON +
-						"\n" + id +
-						"\n" + date::Format(chrono::system_clock::now()) +
-						"\n" + id
-
-				)
-			);
+		Options options;
+		if (!ParseOptions(argc, argv, options)) {
+			PrintUsage();
+			return EXIT_FAILURE;
+		}
+
+		string mix;
+		for (int type = 0; type < TYPES; ++type)
+			mix += (type ? "," : "") + TYPE_NAMES[type] + ":" + str::Str(options.mix[type]);
+		cout << "load: " << options.users << " users, " << options.rate << " msg/sec target, "
+				<< options.duration << " s, " << options.threads << " threads, mix " << mix << endl;
+
+		if (options.setup) {
+			auto begin = chrono::steady_clock::now();
+			auto output = transport::OpenSender(options.transport, LB_INPUT_QUEUE);
+			string msg;
+			for (int64_t id = 1; id <= options.users; ++id) {
+				msg = MSG_USER_REGISTER + "\n";
+				str::Append(msg, id);
+				msg += "\nuser";
+				str::Append(msg, id);
+				output->Publish(msg);
+			}
+			cout << "\tsetup: " << options.users << " registrations in "
+					<< str::Str(chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count(), 0) << " ms" << endl;
+		}
+
+		//пул не длиннее прогона, чтобы не строить лишнего
+		auto begin = chrono::steady_clock::now();
+		const int64_t per_thread = options.rate * options.duration / options.threads + 1;
+		vector<unique_ptr<Pool>> pools;
+		size_t bytes = 0;
+		for (int64_t thread = 0; thread < options.threads; ++thread) {
+			pools.emplace_back(new Pool(options, thread, min(options.pool, per_thread)));
+			bytes += pools.back()->Bytes();
 		}
+		cout << "\tpool: " << pools.front()->Size() << " messages per thread, " << bytes / (1 << 20) << " MB, encoded in "
+				<< str::Str(chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count(), 0) << " ms" << endl;
+
+		vector<unique_ptr<Stats>> stats;
+		vector<thread> senders;
+		const auto start = chrono::steady_clock::now() + chrono::milliseconds(100);
+		const int64_t system_start_us = chrono::duration_cast<chrono::microseconds>(
+				chrono::system_clock::now().time_since_epoch() + (start - chrono::steady_clock::now())).count();
+		for (int64_t thread = 0; thread < options.threads; ++thread) {
+			stats.emplace_back(new Stats());
+			senders.emplace_back(Send, cref(options), thread, ref(*pools[thread]), cref(start), system_start_us, ref(*stats.back()));
+		}
+
+		auto sent = [&stats]() {
+			int64_t total = 0;
+			for (auto &thread_stats : stats)
+				total += thread_stats->sent.load(memory_order_relaxed);
+			return total;
+		};
+		int64_t reported = 0;
+		for (int64_t second = 1; second <= options.duration; ++second) {
+			this_thread::sleep_until(start + chrono::seconds(second));
+			int64_t total = sent();
+			cout << "\t" << second << " s: " << total - reported << " msg/sec" << endl;
+			reported = total;
+		}
+
+		for (auto &sender : senders)
+			sender.join();
+		double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		hist::Histogram lag;
+		int64_t types[TYPES] = {};
+		for (auto &thread_stats : stats) {
+			lag.Merge(thread_stats->lag);
+			for (int type = 0; type < TYPES; ++type)
+				types[type] += thread_stats->types[type];
+		}
+
+		string counts;
+		for (int type = 0; type < TYPES; ++type)
+			counts += (type ? ", " : "") + TYPE_NAMES[type] + " " + str::Str(types[type]);
+		cout << "\tsent " << sent() << " in " << str::Str(secs, 2) << " s, "
+				<< str::Str(sent() / secs, 0) << " msg/sec: " << counts << endl;
+		cout << "\tbehind schedule: p50 " << str::Str(lag.Percentile(0.5) / 1000.0, 1)
+				<< " us, p99 " << str::Str(lag.Percentile(0.99) / 1000.0, 1)
+				<< " us, p99.9 " << str::Str(lag.Percentile(0.999) / 1000.0, 1)
+				<< " us, max " << str::Str(lag.Max() / 1000.0, 1) << " us" << endl;
 	} catch (const std::exception &e) {
 		cout << "Unexpected error thrown: " << e.what() << endl;
 		return EXIT_FAILURE;
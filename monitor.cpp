@@ -1,23 +1,206 @@
+#include <atomic>
 #include <chrono>
+#include <csignal>
 #include <iostream>
-#include <SimpleAmqpClient/SimpleAmqpClient.h>
 
 #include <lb_defines.h>
 #include <lb_functions.h>
+#include <lb_histogram.h>
+#include <lb_transport.h>
 
 using namespace std;
-using namespace AmqpClient;
 
-int main() {
+//штамп, который лидерборд с --stamp дописывает последней строкой сообщения (см. Reminder)
+const string STAMP = "\nStamp: ";
+
+enum Category { CONNECTED, PERIODIC, CATEGORIES };
+enum Span { LATENESS, DELIVERY, TOTAL, TOKEN, SPANS };
+
+const string CATEGORY_NAMES[CATEGORIES] = {"connect", "periodic"};
+const string SPAN_NAMES[SPANS] = {
+	"scheduled -> enqueued",
+	"enqueued -> received",
+	"scheduled -> received",
+	"token -> received"
+};
+
+struct Options {
+	bool dump = false;
+	int64_t duration = 0;
+};
+
+atomic_bool stopped(false);
+
+void PrintUsage() {
+	cout << "Usage:" << endl;
+	cout << "monitor [--transport=amqp|shm] [OPTIONS]" << endl;
+	cout << "[OPTIONS] could be:" << endl;
+	cout << "\t--dump - print every message as is instead of latency statistics" << endl;
+	cout << "\t--duration=N - stop after N seconds (default 0 - until interrupted)" << endl;
+}
+
+bool ParseOptions(int argc, char *argv[], Options &options) {
+	for (int arg = 1; arg < argc; ++arg) {
+		string_view option(argv[arg]);
+		if (option == "--dump") {
+			options.dump = true;
+			continue;
+		}
+
+		const string_view prefix = "--duration=";
+		if (option.substr(0, prefix.size()) != prefix || !str::ToInt64(option.substr(prefix.size()), options.duration)
+				|| options.duration < 0)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Штамп: <c|p> <метка> <назначено> <в очереди>, времена - мкс system_clock
+ */
+struct Stamp {
+	Category category;
+	int64_t token;
+	int64_t scheduled;
+	int64_t enqueued;
+};
+
+bool ParseStamp(string_view body, Stamp &stamp) {
+	size_t pos = body.rfind(STAMP);
+	if (pos == string_view::npos)
+		return false;
+
+	body.remove_prefix(pos + STAMP.size());
+	string_view category = str::NextWord(body, ' ');
+	if (category != "c" && category != "p")
+		return false;
+	stamp.category = category == "c" ? CONNECTED : PERIODIC;
+
+	return str::ToInt64(str::NextWord(body, ' '), stamp.token)
+			&& str::ToInt64(str::NextWord(body, ' '), stamp.scheduled)
+			&& str::ToInt64(str::NextWord(body, ' '), stamp.enqueued);
+}
+
+/*
+ * Гистограммы интервалов по видам сообщений. Часы общие (одна машина) - отрицательное считается нулем
+ */
+struct Latency {
+	hist::Histogram spans[CATEGORIES][SPANS];
+	int64_t received = 0;
+	int64_t unstamped = 0;
+
+	void Add(const Stamp &stamp, int64_t now) {
+		auto add = [this, &stamp](Span span, int64_t from, int64_t to) {
+			spans[stamp.category][span].Add(to > from ? static_cast<uint64_t>(to - from) : 0);
+		};
+
+		add(LATENESS, stamp.scheduled, stamp.enqueued);
+		add(DELIVERY, stamp.enqueued, now);
+		add(TOTAL, stamp.scheduled, now);
+		if (stamp.token)
+			add(TOKEN, stamp.token, now);
+	}
+
+	void Merge(const Latency &other) {
+		for (int category = 0; category < CATEGORIES; ++category)
+			for (int span = 0; span < SPANS; ++span)
+				spans[category][span].Merge(other.spans[category][span]);
+		received += other.received;
+		unstamped += other.unstamped;
+	}
+
+	void Clear() {
+		for (auto &category : spans)
+			for (auto &span : category)
+				span.Clear();
+		received = 0;
+		unstamped = 0;
+	}
+};
+
+string Us(uint64_t value) {
+	return str::Str(static_cast<int64_t>(value)) + " us";
+}
+
+void PrintSecond(int64_t second, const Latency &latency) {
+	cout << "\t" << second << " s: " << latency.received << " msg/sec";
+	for (int category = 0; category < CATEGORIES; ++category) {
+		const hist::Histogram &total = latency.spans[category][TOTAL];
+		if (total.Count())
+			cout << ", " << CATEGORY_NAMES[category] << " " << total.Count() << " p50 " << Us(total.Percentile(0.5))
+					<< " p99 " << Us(total.Percentile(0.99));
+	}
+	if (latency.unstamped)
+		cout << ", unstamped " << latency.unstamped;
+	cout << endl;
+}
+
+void PrintSummary(double secs, const Latency &latency) {
+	cout << "\treceived " << latency.received << " in " << str::Str(secs, 2) << " s, "
+			<< str::Str(latency.received / secs, 0) << " msg/sec, unstamped " << latency.unstamped << endl;
+	for (int category = 0; category < CATEGORIES; ++category) {
+		for (int span = 0; span < SPANS; ++span) {
+			const hist::Histogram &hist = latency.spans[category][span];
+			if (!hist.Count())
+				continue;
+			cout << "\t" << CATEGORY_NAMES[category] << " " << SPAN_NAMES[span] << ": " << hist.Count()
+					<< " msgs, p50 " << Us(hist.Percentile(0.5)) << ", p99 " << Us(hist.Percentile(0.99))
+					<< ", p99.9 " << Us(hist.Percentile(0.999)) << ", max " << Us(hist.Max()) << endl;
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
 	try {
-		Channel::ptr_t connection(Channel::Create(RABBITMQ_HOST));
-		connection->DeclareQueue(LB_OUTPUT_QUEUE, false, false, false, false);
-		string consumer = connection->BasicConsume(LB_OUTPUT_QUEUE, "", true, true);
-		while(true) {
-			auto env = connection->BasicConsumeMessage(consumer);
-			cout << date::Format(chrono::system_clock::now()) << "--------------" << endl
-					<< env->Message()->Body() << endl;
+		Transport kind = transport::Select(argc, argv);
+		Options options;
+		if (!ParseOptions(argc, argv, options)) {
+			PrintUsage();
+			return EXIT_FAILURE;
+		}
+
+		auto input = transport::OpenReceiver(kind, LB_OUTPUT_QUEUE, 0);
+		transport::Delivery delivery;
+		if (options.dump) {
+			while(true) {
+				input->Receive(delivery, -1);
+				cout << date::Format(chrono::system_clock::now()) << "--------------" << endl
+						<< delivery.body << endl;
+			}
+		}
+
+		//по Ctrl+C - итог вместо обрыва
+		signal(SIGINT, [](int) { stopped = true; });
+
+		Latency total;
+		Latency second;
+		const auto start = chrono::steady_clock::now();
+		auto reported = start;
+		int64_t seconds = 0;
+		Stamp stamp;
+		while (!stopped && (!options.duration || seconds < options.duration)) {
+			if (input->Receive(delivery, 100)) {
+				int64_t now = chrono::duration_cast<chrono::microseconds>(
+						chrono::system_clock::now().time_since_epoch()).count();
+				++second.received;
+				if (ParseStamp(delivery.body, stamp))
+					second.Add(stamp, now);
+				else
+					++second.unstamped;
+			}
+
+			if (chrono::steady_clock::now() - reported < chrono::seconds(1))
+				continue;
+
+			reported += chrono::seconds(1);
+			PrintSecond(++seconds, second);
+			total.Merge(second);
+			second.Clear();
 		}
+
+		//остаток неполной секунды
+		total.Merge(second);
+		PrintSummary(chrono::duration<double>(chrono::steady_clock::now() - start).count(), total);
 	} catch (const std::exception &e) {
 		cout << "Unexpected error thrown: " << e.what() << endl;
 		return EXIT_FAILURE;
@@ -25,4 +208,6 @@ int main() {
 		cout << "Unknown unexpected error thrown" << endl;
 		return EXIT_FAILURE;
 	}
+
+	return EXIT_SUCCESS;
 }
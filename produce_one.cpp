@@ -1,14 +1,13 @@
 #include <iostream>
-#include <SimpleAmqpClient/SimpleAmqpClient.h>
 
 #include <lb_defines.h>
+#include <lb_transport.h>
 
 using namespace std;
-using namespace AmqpClient;
 
 void PrintUsage() {
 	cout << "Usage:" << endl;
-	cout << "produce_one [MSG_TYPE] [PARAMS]" << endl;
+	cout << "produce_one [--transport=amqp|shm] [MSG_TYPE] [PARAMS]" << endl;
 	cout << "[MSG_TYPE] with [PARAMS] could be:" << endl;
 	cout << "\tuser_registered [id] [name]" << endl;
 	cout << "\tuser_renamed [id] [name]" << endl;
@@ -55,16 +54,14 @@ bool GetMessageContent(int argc, char *argv[], string &content) {
 
 int main(int argc, char *argv[]) {
 	try {
+		Transport kind = transport::Select(argc, argv);
 		string content;
 		if (!GetMessageContent(argc, argv, content)) {
 			PrintUsage();
 			return EXIT_FAILURE;
 		}
 
-		Channel::ptr_t connection(Channel::Create(RABBITMQ_HOST));
-
-		connection->DeclareQueue(LB_INPUT_QUEUE, false, false, false, false);
-		connection->BasicPublish("", LB_INPUT_ROUTE, BasicMessage::Create(content));
+		transport::OpenSender(kind, LB_INPUT_QUEUE)->Publish(content);
 	} catch (const std::exception &e) {
 		cout << "Unexpected error thrown: " << e.what() << endl;
 		return EXIT_FAILURE;